@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+
+#include "Common.h"
+
+#if _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read only into memory. Pages are only read from disk when first touched, so opening costs
+// the same whatever the size of the file.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	const unsigned char* data() const { return m_data; }
+	uint64 size() const { return m_size; }
+private:
+	const unsigned char* m_data = nullptr;
+	uint64 m_size = 0;
+#if _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = nullptr;
+#endif
+};
+
+#if _WIN32
+inline MappedFile::MappedFile(const std::string& path) {
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE) throw std::runtime_error("failed to open " + path);
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+		CloseHandle(m_file);
+		throw std::runtime_error("failed to map empty or unreadable file " + path);
+	}
+	m_size = uint64(size.QuadPart);
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping) m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data) {
+		if (m_mapping) CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		throw std::runtime_error("failed to map " + path);
+	}
+}
+
+inline MappedFile::~MappedFile() {
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+}
+#else
+inline MappedFile::MappedFile(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) throw std::runtime_error("failed to open " + path);
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		throw std::runtime_error("failed to map empty or unreadable file " + path);
+	}
+	m_size = uint64(info.st_size);
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping keeps the file open
+	close(fd);
+	if (data == MAP_FAILED) throw std::runtime_error("failed to map " + path);
+	// lookups jump around the file, so reading ahead only evicts useful pages
+	madvise(data, m_size, MADV_RANDOM);
+	m_data = static_cast<const unsigned char*>(data);
+}
+
+inline MappedFile::~MappedFile() {
+	munmap(const_cast<unsigned char*>(m_data), m_size);
+}
+#endif
@@ -1,17 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <bitset>
 #include <cassert>
+#include <chrono>
+#include <concepts>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
-#include <random>
 #include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 #include "ankerl/unordered_dense.h"
 #include "Common.h"
-
-extern std::mt19937 s_random;
+#include "Random.h"
+#include "SimdSwipe.h"
+#include "SlideTables.h"
 
 // Returns number of bits necessary to represent integers from 0 up to and including x
 // x = 0 is invalid input
@@ -29,9 +40,27 @@ constexpr uint tileLog2(uint x) {
 #endif
 }
 
+// Position of the k-th lowest set bit of mask, which must have more than k bits set
+inline uint nthSetBit(uint64 mask, uint k) {
+	assert(uint(std::popcount(mask)) > k);
+#if defined(__BMI2__)
+	return uint(std::countr_zero(_pdep_u64(1ull << k, mask)));
+#else
+	uint shift = 0;
+	for (uint bits = uint(std::popcount(mask & 0xFF)); bits <= k; bits = uint(std::popcount(mask & 0xFF))) {
+		k -= bits;
+		mask >>= 8;
+		shift += 8;
+	}
+	for (; k > 0; --k) mask &= mask - 1;
+	return shift + uint(std::countr_zero(mask));
+#endif
+}
+
 template<uint N>
 class packed_bitset{
 public:
+	static constexpr uint NUM_BITS = N;
 	packed_bitset() { memset(m_data, 0, sizeof(m_data)); }
 	bool test(uint n) const {
 		assert(n < N);
@@ -48,6 +77,9 @@ public:
 	bool operator!=(const packed_bitset<N> &that) const {
 		return !(*this == that);
 	}
+	bool operator<(const packed_bitset<N> &that) const {
+		return memcmp(this->m_data, that.m_data, (N+7)/8) < 0;
+	}
 	uint64 hash() const {
 		return ankerl::unordered_dense::ANKERL_UNORDERED_DENSE_NAMESPACE::detail::wyhash::hash(m_data, sizeof(m_data));
 	}
@@ -57,11 +89,163 @@ private:
 	uint8_t m_data[(N+7)/8];
 };
 
-template<uint N, class BITSET_T=packed_bitset<tileLog2(N*N + 1) * N * N>>
+// Packs tiles into 64-bit words such that no tile straddles a word boundary, so a tile is read or
+// written with a single shift and mask. Boards that fit in one word share the byte layout of
+// packed_bitset, which keeps serialized grids compatible between the two backends.
+template<uint NUM_TILES, uint TILE_BITS_>
+class packed_words{
+public:
+	static constexpr uint TILE_BITS = TILE_BITS_;
+	static constexpr uint TILES_PER_WORD = 64 / TILE_BITS;
+	static constexpr uint NUM_WORDS = (NUM_TILES + TILES_PER_WORD - 1) / TILES_PER_WORD;
+	static constexpr uint64 TILE_MASK = (uint64(1) << TILE_BITS) - 1;
+	static constexpr size_t DATA_BYTES = NUM_WORDS == 1 ? (NUM_TILES * TILE_BITS + 7) / 8 : sizeof(uint64) * NUM_WORDS;
+	static_assert(TILE_BITS > 0 && TILE_BITS <= 8, "tiles must fit in a byte");
+	static_assert(std::endian::native == std::endian::little, "packed_words assumes a little endian layout");
+	// lowBits of every word, kept in a table so that a word chosen at run time does not loop over its tiles
+	static constexpr std::array<uint64, NUM_WORDS> LOW_BITS = [] {
+		std::array<uint64, NUM_WORDS> bits{};
+		for (uint i = 0; i < NUM_TILES; ++i) bits[i / TILES_PER_WORD] |= uint64(1) << ((i % TILES_PER_WORD) * TILE_BITS);
+		return bits;
+	}();
+
+	packed_words() : m_data{} {}
+	uint readTile(uint n) const {
+		assert(n < NUM_TILES);
+		return uint(m_data[n / TILES_PER_WORD] >> ((n % TILES_PER_WORD) * TILE_BITS)) & TILE_MASK;
+	}
+	void writeTile(uint n, uint tile) {
+		assert(n < NUM_TILES && tile <= TILE_MASK);
+		uint shift = (n % TILES_PER_WORD) * TILE_BITS;
+		uint64& word = m_data[n / TILES_PER_WORD];
+		word = (word & ~(TILE_MASK << shift)) | (uint64(tile) << shift);
+	}
+	// Bit masks with the lowest or the highest bit of every tile stored in word w
+	static constexpr uint64 lowBits(uint w) { return LOW_BITS[w]; }
+	static constexpr uint64 highBits(uint w) { return lowBits(w) << (TILE_BITS - 1); }
+	// Highest bit of every empty tile in word w, computed for all tiles of the word at once
+	uint64 emptyFields(uint w) const { return zeroFields(m_data[w], w); }
+	// Highest bit of every tile in word w that equals tile
+	uint64 matchingFields(uint w, uint tile) const { return zeroFields(m_data[w] ^ (lowBits(w) * tile), w); }
+	// Highest bit of every tile in word w whose bits at positions >= bit equal those of tile
+	uint64 matchingPrefixFields(uint w, uint tile, uint bit) const {
+		uint64 prefixMask = lowBits(w) * (TILE_MASK & ~((uint64(1) << bit) - 1));
+		return zeroFields((m_data[w] & prefixMask) ^ (lowBits(w) * tile), w);
+	}
+	static uint64 zeroFields(uint64 x, uint w) {
+		// adding the low bits of a tile to their all-ones carries into the tile's highest bit iff they are not all zero
+		uint64 lowMask = highBits(w) - lowBits(w);
+		uint64 nonZero = ((x & lowMask) + lowMask) | x;
+		return ~nonZero & highBits(w);
+	}
+	uint64 word(uint i) const { assert(i < NUM_WORDS); return m_data[i]; }
+	void setWord(uint i, uint64 w) { assert(i < NUM_WORDS); m_data[i] = w; }
+	bool operator==(const packed_words<NUM_TILES, TILE_BITS>& that) const {
+		for (uint i = 0; i < NUM_WORDS; ++i) {
+			if (m_data[i] != that.m_data[i]) return false;
+		}
+		return true;
+	}
+	bool operator!=(const packed_words<NUM_TILES, TILE_BITS>& that) const {
+		return !(*this == that);
+	}
+	bool operator<(const packed_words<NUM_TILES, TILE_BITS>& that) const {
+		for (uint i = NUM_WORDS; i-- > 0;) {
+			if (m_data[i] != that.m_data[i]) return m_data[i] < that.m_data[i];
+		}
+		return false;
+	}
+	uint64 hash() const {
+		if constexpr (NUM_WORDS == 1) {
+			return ankerl::unordered_dense::ANKERL_UNORDERED_DENSE_NAMESPACE::detail::wyhash::hash(m_data[0]);
+		}
+		else {
+			return ankerl::unordered_dense::ANKERL_UNORDERED_DENSE_NAMESPACE::detail::wyhash::hash(m_data, sizeof(m_data));
+		}
+	}
+	void* data() { return m_data; }
+	const void* data() const { return m_data; }
+private:
+	uint64 m_data[NUM_WORDS];
+};
+
+// Backends that can read and write whole tiles and choose their own tile width
+template<class BITSET_T>
+concept TileAddressable = requires(BITSET_T grid, const BITSET_T constGrid, uint n) {
+	{ constGrid.readTile(n) } -> std::convertible_to<uint>;
+	grid.writeTile(n, n);
+	{ BITSET_T::TILE_BITS } -> std::convertible_to<uint>;
+};
+
+// Word packed backends that answer board queries for all tiles of a word at once
+template<class BITSET_T>
+concept SwarQueryable = TileAddressable<BITSET_T> && requires(const BITSET_T grid, uint n) {
+	{ grid.emptyFields(n) } -> std::convertible_to<uint64>;
+	{ grid.matchingFields(n, n) } -> std::convertible_to<uint64>;
+	{ grid.matchingPrefixFields(n, n, n) } -> std::convertible_to<uint64>;
+	{ BITSET_T::NUM_WORDS } -> std::convertible_to<uint>;
+};
+
+// Word packed backends that hold the whole board in one word
+template<class BITSET_T>
+concept SingleWordSwar = SwarQueryable<BITSET_T> && BITSET_T::NUM_WORDS == 1;
+
+template<uint N, class BITSET_T>
+constexpr uint gridTileBits() {
+	if constexpr (TileAddressable<BITSET_T>) return BITSET_T::TILE_BITS;
+	else if constexpr (requires { BITSET_T::NUM_BITS; }) return BITSET_T::NUM_BITS / (N*N);
+	else return tileLog2(N*N + 1);
+}
+
+template<uint N, class BITSET_T>
+constexpr size_t gridDataBytes() {
+	if constexpr (requires { BITSET_T::DATA_BYTES; }) return BITSET_T::DATA_BYTES;
+	else return sizeof(BITSET_T);
+}
+
+// Lines that slide to each line of a SlideTable, built the first time they are needed
+template<uint N, uint TILE_BITS>
+class InverseSlideTable {
+public:
+	static const InverseSlideTable& get(bool towardEnd) {
+		static const InverseSlideTable towardStartTable(SlideTable<N, TILE_BITS>::TOWARD_START);
+		static const InverseSlideTable towardEndTable(SlideTable<N, TILE_BITS>::TOWARD_END);
+		return towardEnd ? towardEndTable : towardStartTable;
+	}
+	const uint16_t* begin(uint64 line) const { return m_sources.data() + m_offsets[line]; }
+	const uint16_t* end(uint64 line) const { return m_sources.data() + m_offsets[line + 1]; }
+private:
+	static constexpr uint NUM_LINES = 1u << (N * TILE_BITS);
+	explicit InverseSlideTable(const uint16_t* slid) : m_offsets(NUM_LINES + 1, 0), m_sources(NUM_LINES) {
+		for (uint line = 0; line < NUM_LINES; ++line) ++m_offsets[slid[line] + 1];
+		for (uint line = 0; line < NUM_LINES; ++line) m_offsets[line + 1] += m_offsets[line];
+		std::vector<uint> next(m_offsets.begin(), m_offsets.end() - 1);
+		for (uint line = 0; line < NUM_LINES; ++line) m_sources[next[slid[line]]++] = uint16_t(line);
+	}
+	std::vector<uint> m_offsets;
+	std::vector<uint16_t> m_sources;
+};
+
+// Swipe directions as (dirRow, dirCol) in the order used by GridState::allMoves: left, right, up, down
+constexpr std::pair<int, int> MOVE_DIRECTIONS[4] = { {0, -1}, {0, 1}, {-1, 0}, {1, 0} };
+
+template<uint N, class BITSET_T>
+struct MoveSet;
+
+// Grids that fit in one word have the byte layout of packed_bitset, which every grid was stored as before. Larger
+// grids are laid out differently, and SqliteTablebase converts the grids of databases written in the old layout.
+template<uint N>
+using default_grid_bitset = packed_words<N * N, tileLog2(N*N + 1)>;
+
+template<uint N, class BITSET_T=default_grid_bitset<N>>
 class GridState{
 public:
-	static constexpr uint BITS_PER_TILE = tileLog2(N*N + 1);
+	static constexpr uint BITS_PER_TILE = gridTileBits<N, BITSET_T>();
 	static constexpr uint GRID_BITS = BITS_PER_TILE * N * N;
+	// Largest tile the grid can hold. Two of them do not merge, so tiles saturate there instead of overflowing.
+	static constexpr uint MAX_TILE = (1u << BITS_PER_TILE) - 1;
+	// Number of leading bytes of gridData() that hold the grid, used for serialization
+	static constexpr size_t GRID_DATA_BYTES = gridDataBytes<N, BITSET_T>();
 	static constexpr std::string tileToStr(uint tile) { return (tile == 0) ? "-" : std::to_string(1u << tile); }
 
 	GridState() : m_grid() {}
@@ -74,10 +258,34 @@ public:
 	void writeTile(uint row, uint col, uint tile);
 	bool isEmpty(uint row, uint col) const;
 	uint swipe(int dirRow, int dirCol);
-	void genRand(float fourRatio);
+	// Swipes one row or column at a time with no table or SIMD kernel, the reference the faster swipes must match
+	uint swipeScalar(int dirRow, int dirCol);
+	MoveSet<N, BITSET_T> allMoves() const;
+	// Appends every other grid that a swipe in MOVE_DIRECTIONS[direction] turns into this one
+	void unswipe(uint direction, std::vector<GridState<N, BITSET_T>>& parents) const;
+	static constexpr bool supportsUnswipe() { return usesSlideTable(); }
+	// Spawns a 2, or a 4 with probability fourRatio, on an empty tile chosen uniformly
+	template<class RNG>
+	void genRand(float fourRatio, RNG& random);
+	void genRand(float fourRatio) { genRand(fourRatio, threadRandom()); }
 	bool hasMoves() const;
 	bool hasTile(uint tile) const;
 	uint numEmptyTiles() const;
+	// Bit row * N + col is set if that tile is empty
+	uint64 emptyMask() const;
+	uint maxTile() const;
+	// Number of tiles with each value, indexed by the tile's exponent, 0 counting empty tiles
+	std::array<uint, (1u << BITS_PER_TILE)> tileHistogram() const;
+	// Sum of the values of all tiles, which a swipe keeps and a spawn raises by 2 or 4
+	uint64 tileSum() const;
+
+	// Symmetries of the square, numbered 0 to 7. Tile (r, c) of the transformed grid is read from the
+	// original after swapping r and c if bit 2 is set, then mirroring r if bit 1 is set and c if bit 0 is set.
+	GridState<N, BITSET_T> transformed(uint symmetry) const;
+	// The smallest of the 8 transformed grids and the symmetry that produces it
+	std::pair<GridState<N, BITSET_T>, uint> canonical() const;
+	// Maps a move made on the transformed grid to the same move on the original grid
+	static std::pair<int, int> untransformMove(std::pair<int, int> move, uint symmetry);
 
 	void printCompact(std::ostream &o) const;
 
@@ -87,13 +295,47 @@ public:
 	bool operator!=(const GridState<N, BITSET_T> &that) const  {
 		return this->m_grid != that.m_grid;
 	}
+	bool operator<(const GridState<N, BITSET_T> &that) const  {
+		return this->m_grid < that.m_grid;
+	}
 private:
+	static constexpr bool usesSlideTable() {
+		if constexpr (requires { BITSET_T::NUM_WORDS; }) {
+			return TileAddressable<BITSET_T> && BITSET_T::NUM_WORDS == 1 && SlideTable<N, BITS_PER_TILE>::AVAILABLE;
+		}
+		else {
+			return false;
+		}
+	}
+	static constexpr bool usesSimdSwipe() { return SIMD_SWIPE && !usesSlideTable(); }
+	static uint64 transposeWord(uint64 grid);
+	uint swipeTable(int dirRow, int dirCol);
+	uint swipeSimd(int dirRow, int dirCol);
+	void allMovesTable(MoveSet<N, BITSET_T>& moves) const;
+	void allMovesSimd(MoveSet<N, BITSET_T>& moves) const;
+	void toLines(LineMatrix<N>& rowLines, LineMatrix<N>& colLines) const;
+	void fromLines(const LineMatrix<N>& lines, bool rowLines);
 	void swap(uint row1, uint col1, uint row2, uint col2);
 	uint slideCol(uint col, bool dir);
 	uint slideRow(uint row, bool dir);
 	BITSET_T m_grid;
 };
 
+// The children of a state for every direction in MOVE_DIRECTIONS, with their merge scores
+template<uint N, class BITSET_T>
+struct MoveSet {
+	GridState<N, BITSET_T> children[4];
+	uint scores[4];
+	// bit i is set if direction i changes the grid
+	uint movedMask;
+	bool moved(uint i) const { return (movedMask >> i) & 1; }
+};
+
+// Word packed grid with tiles capped at 2^MAX_TILE, e.g. CappedGridState<4, 15> fits a 4x4 board in one word.
+// Tiles stop merging at GridState::MAX_TILE, the largest tile their bits hold, which is 15 for CappedGridState<4, 15>.
+template<uint N, uint MAX_TILE>
+using CappedGridState = GridState<N, packed_words<N * N, tileLog2(MAX_TILE)>>;
+
 template<uint N, class BITSET_T>
 void GridState<N, BITSET_T>::swap(uint row1, uint col1, uint row2, uint col2) {
 	uint tile1 = readTile(row1, col1);
@@ -118,7 +360,7 @@ uint GridState<N, BITSET_T>::slideCol(uint col, bool dir) {
 						lastSlideFused = false;
 					}
 				}
-				else if(readTile(rf, col) == readTile(rf - 1, col) && !lastSlideFused) {
+				else if(readTile(rf, col) == readTile(rf - 1, col) && readTile(rf, col) != MAX_TILE && !lastSlideFused) {
 					// fuse with identical tile
 					lastSlideFused = true;
 					uint fusedTile = readTile(rf, col) + 1;
@@ -146,7 +388,7 @@ uint GridState<N, BITSET_T>::slideCol(uint col, bool dir) {
 						lastSlideFused = false;
 					}
 				}
-				else if(readTile(rf, col) == readTile(rf + 1, col) && !lastSlideFused) {
+				else if(readTile(rf, col) == readTile(rf + 1, col) && readTile(rf, col) != MAX_TILE && !lastSlideFused) {
 					// fuse with identical tile
 					lastSlideFused = true;
 					uint fusedTile = readTile(rf, col) + 1;
@@ -182,7 +424,7 @@ uint GridState<N, BITSET_T>::slideRow(uint row, bool dir) {
 						lastSlideFused = false;
 					}
 				}
-				else if(readTile(row, cf) == readTile(row, cf - 1) && !lastSlideFused) {
+				else if(readTile(row, cf) == readTile(row, cf - 1) && readTile(row, cf) != MAX_TILE && !lastSlideFused) {
 					// fuse with identical tile
 					lastSlideFused = true;
 					uint fusedTile = readTile(row, cf) + 1;
@@ -210,7 +452,7 @@ uint GridState<N, BITSET_T>::slideRow(uint row, bool dir) {
 						lastSlideFused = false;
 					}
 				}
-				else if(readTile(row, cf) == readTile(row, cf + 1) && !lastSlideFused) {
+				else if(readTile(row, cf) == readTile(row, cf + 1) && readTile(row, cf) != MAX_TILE && !lastSlideFused) {
 					// fuse with identical tile
 					lastSlideFused = true;
 					uint fusedTile = readTile(row, cf) + 1;
@@ -233,19 +475,29 @@ uint GridState<N, BITSET_T>::slideRow(uint row, bool dir) {
 template<uint N, class BITSET_T>
 uint GridState<N, BITSET_T>::readTile(uint row, uint col) const {
 	assert(row < N && col < N);
-	uint tile = 0;
-	for(uint i = 0; i < BITS_PER_TILE; ++i) {
-		tile |= (m_grid.test((row * N + col) * BITS_PER_TILE + i) << i);
+	if constexpr (TileAddressable<BITSET_T>) {
+		return m_grid.readTile(row * N + col);
+	}
+	else {
+		uint tile = 0;
+		for(uint i = 0; i < BITS_PER_TILE; ++i) {
+			tile |= (m_grid.test((row * N + col) * BITS_PER_TILE + i) << i);
+		}
+		return tile;
 	}
-	return tile;
 }
 
 template<uint N, class BITSET_T>
 void GridState<N, BITSET_T>::writeTile(uint row, uint col, uint tile) {
 	assert(row < N && col < N);
-	for(uint i = 0; i < BITS_PER_TILE; ++i) {
-		m_grid.set((row * N + col) * BITS_PER_TILE + i, tile & 1);
-		tile >>= 1;
+	if constexpr (TileAddressable<BITSET_T>) {
+		m_grid.writeTile(row * N + col, tile);
+	}
+	else {
+		for(uint i = 0; i < BITS_PER_TILE; ++i) {
+			m_grid.set((row * N + col) * BITS_PER_TILE + i, tile & 1);
+			tile >>= 1;
+		}
 	}
 }
 
@@ -257,6 +509,17 @@ bool GridState<N, BITSET_T>::isEmpty(uint row, uint col) const {
 template<uint N, class BITSET_T>
 uint GridState<N, BITSET_T>::swipe(int dirRow, int dirCol) {
 	assert(((dirRow == -1 || dirRow == 1) && dirCol == 0) || ((dirCol == -1 || dirCol == 1) && dirRow == 0));
+	if constexpr (usesSlideTable()) {
+		return swipeTable(dirRow, dirCol);
+	}
+	else if constexpr (usesSimdSwipe()) {
+		if (simdSwipeSupported()) return swipeSimd(dirRow, dirCol);
+	}
+	return swipeScalar(dirRow, dirCol);
+}
+
+template<uint N, class BITSET_T>
+uint GridState<N, BITSET_T>::swipeScalar(int dirRow, int dirCol) {
 	uint sumOfNewTiles = 0;
 	if(dirCol == 0) {
 		for(uint col = 0; col < N; ++col) {
@@ -271,56 +534,386 @@ uint GridState<N, BITSET_T>::swipe(int dirRow, int dirCol) {
 	return sumOfNewTiles;
 }
 
-// Don't call if a full grid
+// Swaps rows and columns of a single word grid
+template<uint N, class BITSET_T>
+uint64 GridState<N, BITSET_T>::transposeWord(uint64 grid) {
+	constexpr uint64 TILE_MASK = (uint64(1) << BITS_PER_TILE) - 1;
+	uint64 transposed = 0;
+	for (uint r = 0; r < N; ++r) {
+		for (uint c = 0; c < N; ++c) {
+			uint64 tile = (grid >> ((r * N + c) * BITS_PER_TILE)) & TILE_MASK;
+			transposed |= tile << ((c * N + r) * BITS_PER_TILE);
+		}
+	}
+	return transposed;
+}
+
+// Slides every row with one lookup in the generated SlideTable. Columns are transposed into rows and back.
 template<uint N, class BITSET_T>
-void GridState<N, BITSET_T>::genRand(float fourRatio) {
-	std::uniform_real_distribution<float> d_dist;
-	std::uniform_int_distribution<uint> i_dist(0, N-1);
-	float roll = d_dist(s_random);
-	for(uint i = 0; i < 1000*N*N; ++i) {
-		uint row = i_dist(s_random);
-		uint col = i_dist(s_random);
-		if(readTile(row, col) == 0) {
-			writeTile(row, col, roll < fourRatio ? 2 : 1);
-			return;
+uint GridState<N, BITSET_T>::swipeTable(int dirRow, int dirCol) {
+	using Table = SlideTable<N, BITS_PER_TILE>;
+	constexpr uint LINE_BITS = N * BITS_PER_TILE;
+	constexpr uint64 LINE_MASK = (uint64(1) << LINE_BITS) - 1;
+	bool towardEnd = (dirCol == 0) ? dirRow == 1 : dirCol == 1;
+	const uint16_t* lines = towardEnd ? Table::TOWARD_END : Table::TOWARD_START;
+	const uint32_t* scores = towardEnd ? Table::TOWARD_END_SCORE : Table::TOWARD_START_SCORE;
+
+	uint64 grid = m_grid.word(0);
+	if (dirCol == 0) grid = transposeWord(grid);
+	uint64 slid = 0;
+	uint sumOfNewTiles = 0;
+	for (uint i = 0; i < N; ++i) {
+		uint64 line = (grid >> (i * LINE_BITS)) & LINE_MASK;
+		slid |= uint64(lines[line]) << (i * LINE_BITS);
+		sumOfNewTiles += scores[line];
+	}
+	if (dirCol == 0) slid = transposeWord(slid);
+	m_grid.setWord(0, slid);
+	return sumOfNewTiles;
+}
+
+// Combines every preimage of every row or column under the slide table
+template<uint N, class BITSET_T>
+void GridState<N, BITSET_T>::unswipe(uint direction, std::vector<GridState<N, BITSET_T>>& parents) const {
+	static_assert(supportsUnswipe(), "unswipe needs a slide table for this grid");
+	constexpr uint LINE_BITS = N * BITS_PER_TILE;
+	constexpr uint64 LINE_MASK = (uint64(1) << LINE_BITS) - 1;
+	bool columns = direction >= 2;
+	const auto& inverse = InverseSlideTable<N, BITS_PER_TILE>::get(direction & 1);
+
+	uint64 grid = m_grid.word(0);
+	if (columns) grid = transposeWord(grid);
+	const uint16_t* sources[N];
+	const uint16_t* sourcesEnd[N];
+	const uint16_t* current[N];
+	for (uint i = 0; i < N; ++i) {
+		uint64 line = (grid >> (i * LINE_BITS)) & LINE_MASK;
+		sources[i] = current[i] = inverse.begin(line);
+		sourcesEnd[i] = inverse.end(line);
+		if (sources[i] == sourcesEnd[i]) return;
+	}
+	for (;;) {
+		uint64 parent = 0;
+		for (uint i = 0; i < N; ++i) parent |= uint64(*current[i]) << (i * LINE_BITS);
+		if (parent != grid) {
+			GridState<N, BITSET_T> state;
+			state.m_grid.setWord(0, columns ? transposeWord(parent) : parent);
+			parents.push_back(state);
+		}
+		uint i = 0;
+		for (; i < N; ++i) {
+			if (++current[i] != sourcesEnd[i]) break;
+			current[i] = sources[i];
 		}
+		if (i == N) return;
 	}
-	// If we haven't found an empty tile in 1000N**2 attempts, the grid is probably full.
+}
+
+// Unpacks the grid into one byte per tile, with rows as lines in rowLines and columns as lines in colLines
+template<uint N, class BITSET_T>
+void GridState<N, BITSET_T>::toLines(LineMatrix<N>& rowLines, LineMatrix<N>& colLines) const {
+	for (uint r = 0; r < N; ++r) {
+		for (uint c = 0; c < N; ++c) {
+			uint8_t tile = uint8_t(readTile(r, c));
+			rowLines.cells[c][r] = tile;
+			colLines.cells[r][c] = tile;
+		}
+	}
+}
+
+template<uint N, class BITSET_T>
+void GridState<N, BITSET_T>::fromLines(const LineMatrix<N>& lines, bool rowLines) {
+	for (uint r = 0; r < N; ++r) {
+		for (uint c = 0; c < N; ++c) {
+			writeTile(r, c, rowLines ? lines.cells[c][r] : lines.cells[r][c]);
+		}
+	}
+}
+
+// Slides all rows or all columns at once with simdSlideLines
+template<uint N, class BITSET_T>
+uint GridState<N, BITSET_T>::swipeSimd(int dirRow, int dirCol) {
+#if SIMD_SWIPE
+	bool slideRows = dirCol != 0;
+	LineMatrix<N> rowLines{};
+	LineMatrix<N> colLines{};
+	LineMatrix<N> slid;
+	toLines(rowLines, colLines);
+	uint sumOfNewTiles = simdSlideLines(slideRows ? rowLines : colLines, slideRows ? dirCol == 1 : dirRow == 1, MAX_TILE, slid);
+	fromLines(slid, slideRows);
+	return sumOfNewTiles;
+#else
+	(void)dirRow;
+	(void)dirCol;
 	assert(0);
+	return 0;
+#endif
 }
 
+template<uint N, class BITSET_T>
+MoveSet<N, BITSET_T> GridState<N, BITSET_T>::allMoves() const {
+	MoveSet<N, BITSET_T> moves;
+	if constexpr (usesSlideTable()) {
+		allMovesTable(moves);
+	}
+	else if (usesSimdSwipe() && simdSwipeSupported()) {
+		allMovesSimd(moves);
+	}
+	else {
+		for (uint i = 0; i < 4; ++i) {
+			moves.children[i] = *this;
+			moves.scores[i] = moves.children[i].swipe(MOVE_DIRECTIONS[i].first, MOVE_DIRECTIONS[i].second);
+		}
+	}
+	moves.movedMask = 0;
+	for (uint i = 0; i < 4; ++i) {
+		moves.movedMask |= uint(moves.children[i] != *this) << i;
+	}
+	return moves;
+}
+
+// Looks up every row and column once and slides it both ways
+template<uint N, class BITSET_T>
+void GridState<N, BITSET_T>::allMovesTable(MoveSet<N, BITSET_T>& moves) const {
+	using Table = SlideTable<N, BITS_PER_TILE>;
+	constexpr uint LINE_BITS = N * BITS_PER_TILE;
+	constexpr uint64 LINE_MASK = (uint64(1) << LINE_BITS) - 1;
+	uint64 grids[2] = { m_grid.word(0), transposeWord(m_grid.word(0)) };
+	for (uint axis = 0; axis < 2; ++axis) {
+		uint64 towardStart = 0;
+		uint64 towardEnd = 0;
+		uint scoreTowardStart = 0;
+		uint scoreTowardEnd = 0;
+		for (uint i = 0; i < N; ++i) {
+			uint64 line = (grids[axis] >> (i * LINE_BITS)) & LINE_MASK;
+			towardStart |= uint64(Table::TOWARD_START[line]) << (i * LINE_BITS);
+			towardEnd |= uint64(Table::TOWARD_END[line]) << (i * LINE_BITS);
+			scoreTowardStart += Table::TOWARD_START_SCORE[line];
+			scoreTowardEnd += Table::TOWARD_END_SCORE[line];
+		}
+		if (axis == 1) {
+			towardStart = transposeWord(towardStart);
+			towardEnd = transposeWord(towardEnd);
+		}
+		// left, right for rows and up, down for columns
+		moves.children[2 * axis].m_grid.setWord(0, towardStart);
+		moves.children[2 * axis + 1].m_grid.setWord(0, towardEnd);
+		moves.scores[2 * axis] = scoreTowardStart;
+		moves.scores[2 * axis + 1] = scoreTowardEnd;
+	}
+}
+
+// Unpacks the grid once and runs the kernel for each direction
+template<uint N, class BITSET_T>
+void GridState<N, BITSET_T>::allMovesSimd(MoveSet<N, BITSET_T>& moves) const {
+#if SIMD_SWIPE
+	LineMatrix<N> lines[2] = {};
+	LineMatrix<N> slid;
+	toLines(lines[0], lines[1]);
+	for (uint i = 0; i < 4; ++i) {
+		bool rowLines = i < 2;
+		moves.scores[i] = simdSlideLines(lines[rowLines ? 0 : 1], i & 1, MAX_TILE, slid);
+		moves.children[i].fromLines(slid, rowLines);
+	}
+#else
+	(void)moves;
+	assert(0);
+#endif
+}
+
+// Don't call if a full grid
+template<uint N, class BITSET_T>
+template<class RNG>
+void GridState<N, BITSET_T>::genRand(float fourRatio, RNG& random) {
+	uint64 empty = emptyMask();
+	assert(empty != 0);
+	float roll = randomUnitFloat(random);
+	uint tile = nthSetBit(empty, randomBelow(random, uint(std::popcount(empty))));
+	writeTile(tile / N, tile % N, roll < fourRatio ? 2 : 1);
+}
+
+// A move exists iff there is an empty tile next to a non empty one, which any partially filled grid has,
+// or two equal neighbouring tiles
 template<uint N, class BITSET_T>
 bool GridState<N, BITSET_T>::hasMoves() const {
-	GridState<N> clone1 = *this;
-	clone1.swipe(1, 0);
-	GridState<N> clone2 = *this;
-	clone2.swipe(-1, 0);
-	GridState<N> clone3 = *this;
-	clone3.swipe(0, 1);
-	GridState<N> clone4 = *this;
-	clone4.swipe(0,-1);
-	return !(clone1 == *this && clone2 == *this && clone3 == *this && clone4 == *this);
+	uint emptyTiles = numEmptyTiles();
+	if (emptyTiles == N * N) return false;
+	if (emptyTiles > 0) return true;
+	if constexpr (SingleWordSwar<BITSET_T>) {
+		constexpr uint64 highBits = BITSET_T::highBits(0);
+		// highest bit of every tile that has a right neighbour, or one below it
+		uint64 hasRight = 0;
+		for (uint i = 0; i < N * N; ++i) {
+			if (i % N != N - 1) hasRight |= uint64(1) << ((i + 1) * BITS_PER_TILE - 1);
+		}
+		uint64 hasBelow = highBits >> (N * BITS_PER_TILE);
+		uint64 grid = m_grid.word(0);
+		uint64 equalRight = BITSET_T::zeroFields(grid ^ (grid >> BITS_PER_TILE), 0) & hasRight;
+		uint64 equalBelow = BITSET_T::zeroFields(grid ^ (grid >> (N * BITS_PER_TILE)), 0) & hasBelow;
+		// saturated tiles do not merge
+		return ((equalRight | equalBelow) & ~m_grid.matchingFields(0, MAX_TILE)) != 0;
+	}
+	else {
+		for (uint r = 0; r < N; ++r) {
+			for (uint c = 0; c < N; ++c) {
+				uint tile = readTile(r, c);
+				if (tile == MAX_TILE) continue;
+				if ((c + 1 < N && readTile(r, c + 1) == tile) || (r + 1 < N && readTile(r + 1, c) == tile)) return true;
+			}
+		}
+		return false;
+	}
 }
 
 template<uint N, class BITSET_T>
 bool GridState<N, BITSET_T>::hasTile(uint tile) const {
-	for(uint r = 0; r < N; ++r) {
-		for(uint c = 0; c < N; c++) {
-			if(readTile(r, c) == tile) return true;
+	if constexpr (SwarQueryable<BITSET_T>) {
+		if (tile >= (1u << BITS_PER_TILE)) return false;
+		for (uint w = 0; w < BITSET_T::NUM_WORDS; ++w) {
+			if (m_grid.matchingFields(w, tile)) return true;
+		}
+		return false;
+	}
+	else {
+		for(uint r = 0; r < N; ++r) {
+			for(uint c = 0; c < N; c++) {
+				if(readTile(r, c) == tile) return true;
+			}
 		}
+		return false;
 	}
-	return false;
 }
 
 template<uint N, class BITSET_T>
 uint GridState<N, BITSET_T>::numEmptyTiles() const {
-	uint emptyTiles = 0;
-	for(uint r = 0; r < N; ++r) {
-		for(uint c = 0; c < N; c++) {
-			emptyTiles += isEmpty(r,c);
+	if constexpr (SwarQueryable<BITSET_T>) {
+		uint emptyTiles = 0;
+		for (uint w = 0; w < BITSET_T::NUM_WORDS; ++w) {
+			emptyTiles += std::popcount(m_grid.emptyFields(w));
+		}
+		return emptyTiles;
+	}
+	else {
+		uint emptyTiles = 0;
+		for(uint r = 0; r < N; ++r) {
+			for(uint c = 0; c < N; c++) {
+				emptyTiles += isEmpty(r,c);
+			}
+		}
+		return emptyTiles;
+	}
+}
+
+template<uint N, class BITSET_T>
+uint64 GridState<N, BITSET_T>::emptyMask() const {
+	uint64 mask = 0;
+	if constexpr (SwarQueryable<BITSET_T>) {
+		for (uint w = 0; w < BITSET_T::NUM_WORDS; ++w) {
+			for (uint64 fields = m_grid.emptyFields(w); fields; fields &= fields - 1) {
+				uint tile = w * BITSET_T::TILES_PER_WORD + uint(std::countr_zero(fields)) / BITS_PER_TILE;
+				mask |= uint64(1) << tile;
+			}
+		}
+	}
+	else {
+		for (uint i = 0; i < N * N; ++i) {
+			mask |= uint64(isEmpty(i / N, i % N)) << i;
+		}
+	}
+	return mask;
+}
+
+// Builds the largest tile one bit at a time, keeping a bit if some tile starts with the bits found so far
+template<uint N, class BITSET_T>
+uint GridState<N, BITSET_T>::maxTile() const {
+	if constexpr (SwarQueryable<BITSET_T>) {
+		uint tile = 0;
+		for (int bit = BITS_PER_TILE - 1; bit >= 0; --bit) {
+			uint candidate = tile | (1u << bit);
+			for (uint w = 0; w < BITSET_T::NUM_WORDS; ++w) {
+				if (m_grid.matchingPrefixFields(w, candidate, bit)) {
+					tile = candidate;
+					break;
+				}
+			}
+		}
+		return tile;
+	}
+	else {
+		uint tile = 0;
+		for (uint i = 0; i < N * N; ++i) {
+			tile = std::max(tile, readTile(i / N, i % N));
+		}
+		return tile;
+	}
+}
+
+template<uint N, class BITSET_T>
+std::array<uint, (1u << GridState<N, BITSET_T>::BITS_PER_TILE)> GridState<N, BITSET_T>::tileHistogram() const {
+	std::array<uint, (1u << BITS_PER_TILE)> histogram{};
+	if constexpr (SwarQueryable<BITSET_T>) {
+		// values are counted from the smallest up, until every tile has been counted
+		uint counted = 0;
+		for (uint tile = 0; counted < N * N; ++tile) {
+			for (uint w = 0; w < BITSET_T::NUM_WORDS; ++w) {
+				histogram[tile] += uint(std::popcount(m_grid.matchingFields(w, tile)));
+			}
+			counted += histogram[tile];
+		}
+	}
+	else {
+		for (uint i = 0; i < N * N; ++i) {
+			++histogram[readTile(i / N, i % N)];
+		}
+	}
+	return histogram;
+}
+
+template<uint N, class BITSET_T>
+uint64 GridState<N, BITSET_T>::tileSum() const {
+	auto histogram = tileHistogram();
+	uint64 sum = 0;
+	for (uint tile = 1; tile < histogram.size(); ++tile) {
+		if (histogram[tile]) sum += uint64(histogram[tile]) << tile;
+	}
+	return sum;
+}
+
+template<uint N, class BITSET_T>
+GridState<N, BITSET_T> GridState<N, BITSET_T>::transformed(uint symmetry) const {
+	assert(symmetry < 8);
+	GridState<N, BITSET_T> result;
+	for (uint r = 0; r < N; ++r) {
+		for (uint c = 0; c < N; ++c) {
+			uint srcRow = (symmetry & 4) ? c : r;
+			uint srcCol = (symmetry & 4) ? r : c;
+			if (symmetry & 2) srcRow = N - 1 - srcRow;
+			if (symmetry & 1) srcCol = N - 1 - srcCol;
+			result.writeTile(r, c, readTile(srcRow, srcCol));
 		}
 	}
-	return emptyTiles;
+	return result;
+}
+
+template<uint N, class BITSET_T>
+std::pair<GridState<N, BITSET_T>, uint> GridState<N, BITSET_T>::canonical() const {
+	std::pair<GridState<N, BITSET_T>, uint> best(*this, 0);
+	for (uint symmetry = 1; symmetry < 8; ++symmetry) {
+		GridState<N, BITSET_T> candidate = transformed(symmetry);
+		if (candidate < best.first) {
+			best = std::make_pair(candidate, symmetry);
+		}
+	}
+	return best;
+}
+
+template<uint N, class BITSET_T>
+std::pair<int, int> GridState<N, BITSET_T>::untransformMove(std::pair<int, int> move, uint symmetry) {
+	assert(symmetry < 8);
+	if (symmetry & 4) std::swap(move.first, move.second);
+	if (symmetry & 2) move.first = -move.first;
+	if (symmetry & 1) move.second = -move.second;
+	return move;
 }
 
 template<uint N, class BITSET_T>
@@ -349,12 +942,13 @@ std::ostream& operator<<(std::ostream& o, const GridState<N, BITSET_T>& grid) {
 template<uint N>
 class Game {
 public:
-	Game(float fourChance) : m_state(), m_score{0}, m_fourChance{fourChance}, m_gameOver{false} { 
-		m_state.genRand(fourChance);
+	Game(float fourChance, uint64 seed = randomSeed())
+		: m_state(), m_score{0}, m_fourChance{fourChance}, m_gameOver{false}, m_random(seed) {
+		m_state.genRand(fourChance, m_random);
 	}
 	void reset() { 
 		m_state = GridState<N>();
-		m_state.genRand(m_fourChance);
+		m_state.genRand(m_fourChance, m_random);
 		m_gameOver = false;
 		m_score = 0;
 	}
@@ -363,7 +957,7 @@ public:
 		GridState<N> prevState = m_state;
 		m_score += m_state.swipe(dirRow, dirCol);
 		if(m_state != prevState) {
-			m_state.genRand(m_fourChance);
+			m_state.genRand(m_fourChance, m_random);
 			updateGameOver();
 		}
 	}
@@ -377,6 +971,7 @@ private:
 	uint m_score;
 	float m_fourChance;
 	bool m_gameOver;
+	Xoshiro256 m_random;
 };
 
 template<uint N>
@@ -391,6 +986,130 @@ std::ostream& operator<<(std::ostream& o, const Game<N>& game) {
 	return o;
 }
 
+// Many games stepped together, kept as parallel arrays of boards, scores and game over flags.
+// All spawns come from the batch's own generator.
+template<uint N>
+class GameBatch {
+public:
+	GameBatch(uint numGames, float fourChance, uint64 seed = randomSeed());
+	void reset();
+	// Starts a new game in every slot whose game is over, returns how many were restarted
+	uint resetFinished();
+	// Applies moves[i] to game i and spawns a tile on each board that changed. Moves of finished games
+	// are ignored. Returns the number of games still running. Each board is swiped on its own with the
+	// board's kernel, since games rarely take the same direction.
+	uint swipe(const std::vector<std::pair<int, int>>& moves);
+	// Plays every running game to its end, policy(state) choosing the move of each game
+	template<class POLICY>
+	void playOut(POLICY&& policy);
+	// Keeps playing games with policy for about the given time, restarting finished slots, and returns
+	// the number of completed games per second
+	template<class POLICY>
+	double measureThroughput(POLICY&& policy, double seconds);
+
+	uint size() const { return uint(m_states.size()); }
+	uint numRunning() const { return m_numRunning; }
+	const GridState<N>& getState(uint i) const { return m_states[i]; }
+	uint getScore(uint i) const { return m_scores[i]; }
+	bool isGameOver(uint i) const { return m_gameOver[i] != 0; }
+private:
+	void startGame(uint i);
+	template<class POLICY>
+	void chooseMoves(POLICY& policy);
+	std::vector<GridState<N>> m_states;
+	std::vector<uint> m_scores;
+	std::vector<uint8_t> m_gameOver;
+	std::vector<std::pair<int, int>> m_moves;
+	float m_fourChance;
+	uint m_numRunning;
+	Xoshiro256 m_random;
+};
+
+template<uint N>
+GameBatch<N>::GameBatch(uint numGames, float fourChance, uint64 seed)
+	: m_states(numGames), m_scores(numGames), m_gameOver(numGames), m_fourChance{fourChance}, m_numRunning{0}, m_random(seed) {
+	reset();
+}
+
+template<uint N>
+void GameBatch<N>::startGame(uint i) {
+	m_states[i] = GridState<N>();
+	m_states[i].genRand(m_fourChance, m_random);
+	m_scores[i] = 0;
+	m_gameOver[i] = 0;
+}
+
+template<uint N>
+void GameBatch<N>::reset() {
+	for (uint i = 0; i < size(); ++i) startGame(i);
+	m_numRunning = size();
+}
+
+template<uint N>
+uint GameBatch<N>::resetFinished() {
+	uint numReset = 0;
+	for (uint i = 0; i < size(); ++i) {
+		if (m_gameOver[i]) {
+			startGame(i);
+			++numReset;
+		}
+	}
+	m_numRunning += numReset;
+	return numReset;
+}
+
+template<uint N>
+uint GameBatch<N>::swipe(const std::vector<std::pair<int, int>>& moves) {
+	assert(moves.size() == size());
+	for (uint i = 0; i < size(); ++i) {
+		if (m_gameOver[i]) continue;
+		GridState<N> prevState = m_states[i];
+		m_scores[i] += m_states[i].swipe(moves[i].first, moves[i].second);
+		if (m_states[i] != prevState) {
+			m_states[i].genRand(m_fourChance, m_random);
+			if (!m_states[i].hasMoves()) {
+				m_gameOver[i] = 1;
+				--m_numRunning;
+			}
+		}
+	}
+	return m_numRunning;
+}
+
+template<uint N>
+template<class POLICY>
+void GameBatch<N>::chooseMoves(POLICY& policy) {
+	m_moves.resize(size());
+	for (uint i = 0; i < size(); ++i) {
+		if (!m_gameOver[i]) m_moves[i] = policy(m_states[i]);
+	}
+}
+
+template<uint N>
+template<class POLICY>
+void GameBatch<N>::playOut(POLICY&& policy) {
+	while (m_numRunning > 0) {
+		chooseMoves(policy);
+		swipe(m_moves);
+	}
+}
+
+template<uint N>
+template<class POLICY>
+double GameBatch<N>::measureThroughput(POLICY&& policy, double seconds) {
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed(0);
+	uint64 completedGames = 0;
+	reset();
+	while (elapsed.count() < seconds) {
+		chooseMoves(policy);
+		swipe(m_moves);
+		completedGames += resetFinished();
+		elapsed = std::chrono::steady_clock::now() - start;
+	}
+	return completedGames / elapsed.count();
+}
+
 namespace std {
 	template<uint N>
 	struct hash<packed_bitset<N>> {
@@ -399,9 +1118,16 @@ namespace std {
 		}
 	};
 	
-	template<uint N>
-	struct hash<GridState<N>> {
-		std::size_t operator()(const GridState<N>& n) {
+	template<uint NUM_TILES, uint TILE_BITS>
+	struct hash<packed_words<NUM_TILES, TILE_BITS>> {
+		std::size_t operator()(const packed_words<NUM_TILES, TILE_BITS>& n) {
+			return n.hash();
+		}
+	};
+
+	template<uint N, class BITSET_T>
+	struct hash<GridState<N, BITSET_T>> {
+		std::size_t operator()(const GridState<N, BITSET_T>& n) {
 			return n.getGrid().hash();
 		}
 	};
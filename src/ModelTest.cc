@@ -1,7 +1,10 @@
 #include "Model.h"
+#include "Parallel.h"
 #include "TemplateAdaptor.h"
 
+#include <chrono>
 #include <iostream>
+#include <thread>
 
 GridState<2> s_grid2;
 GridState<3> s_grid3;
@@ -11,8 +14,65 @@ GridState<6> s_grid6;
 GridState<7> s_grid7;
 GridState<8> s_grid8;
 
-std::mt19937 s_random((std::random_device())());
+// Inserts keys drawn at random from a shared pool on numThreads threads at once, so threads keep hitting the same
+// slots, and returns the number of inserts per second
+double measureConcurrentMap(const std::vector<GridState<4>>& keys, uint numThreads, uint64 numInserts) {
+	ConcurrentMap<GridState<4>> map(2 * keys.size());
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (uint t = 0; t < numThreads; ++t) {
+		threads.emplace_back([&, t] {
+			Xoshiro256 random(t);
+			for (uint64 i = 0; i < numInserts / numThreads; ++i) {
+				map.insertMin(keys[randomBelow(random, uint(keys.size()))], i);
+			}
+		});
+	}
+	for (std::thread& thread : threads) thread.join();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return numInserts / elapsed.count();
+}
 
+// Swipes random boards in every direction, one direction at a time and with allMoves, and compares the grids, merge
+// scores, moved directions and hasMoves with swipeScalar on a packed_bitset grid with tiles of the same width. Each
+// board draws its tiles from a random range up to maxTile, so that some boards are crowded with equal tiles and merge
+// a lot.
+template<uint N, class BITSET_T>
+void checkSwipes(const char* name, uint maxTile, uint numBoards, Xoshiro256& random) {
+	using Reference = GridState<N, packed_bitset<GridState<N, BITSET_T>::BITS_PER_TILE * N * N>>;
+	auto sameTiles = [](const GridState<N, BITSET_T>& grid, const Reference& reference) {
+		for (uint i = 0; i < N * N; ++i) {
+			if (grid.readTile(i / N, i % N) != reference.readTile(i / N, i % N)) return false;
+		}
+		return true;
+	};
+	uint mismatches = 0;
+	for (uint board = 0; board < numBoards; ++board) {
+		GridState<N, BITSET_T> grid;
+		Reference reference;
+		uint range = 1 + randomBelow(random, maxTile);
+		for (uint i = 0; i < N * N; ++i) {
+			uint tile = randomBelow(random, range + 1);
+			grid.writeTile(i / N, i % N, tile);
+			reference.writeTile(i / N, i % N, tile);
+		}
+		auto moves = grid.allMoves();
+		uint movedMask = 0;
+		bool same = true;
+		for (uint i = 0; i < 4; ++i) {
+			auto [dirRow, dirCol] = MOVE_DIRECTIONS[i];
+			Reference expected = reference;
+			uint expectedScore = expected.swipeScalar(dirRow, dirCol);
+			movedMask |= uint(expected != reference) << i;
+			GridState<N, BITSET_T> swiped = grid;
+			uint score = swiped.swipe(dirRow, dirCol);
+			same = same && score == expectedScore && sameTiles(swiped, expected);
+			same = same && moves.scores[i] == expectedScore && sameTiles(moves.children[i], expected);
+		}
+		if (!same || moves.movedMask != movedMask || grid.hasMoves() != (movedMask != 0)) ++mismatches;
+	}
+	std::cout << name << " swipes: " << mismatches << " of " << numBoards << " boards differ" << std::endl;
+}
 
 int main() {
 	std::cout << "2x2: " << GridState<2>::BITS_PER_TILE << " bits-per-tile " << GridState<2>::GRID_BITS << " bits-per-grid " << sizeof(GridState<2>) << " bytes in memory." << std::endl;
@@ -22,6 +82,7 @@ int main() {
 	std::cout << "6x6: " << GridState<6>::BITS_PER_TILE << " bits-per-tile " << GridState<6>::GRID_BITS << " bits-per-grid " << sizeof(GridState<6>) << " bytes in memory." << std::endl;
 	std::cout << "7x7: " << GridState<7>::BITS_PER_TILE << " bits-per-tile " << GridState<7>::GRID_BITS << " bits-per-grid " << sizeof(GridState<7>) << " bytes in memory." << std::endl;
 	std::cout << "8x8: " << GridState<8>::BITS_PER_TILE << " bits-per-tile " << GridState<8>::GRID_BITS << " bits-per-grid " << sizeof(GridState<8>) << " bytes in memory." << std::endl;
+	std::cout << "4x4 (capped): " << CappedGridState<4, 15>::BITS_PER_TILE << " bits-per-tile " << CappedGridState<4, 15>::GRID_BITS << " bits-per-grid " << sizeof(CappedGridState<4, 15>) << " bytes in memory." << std::endl;
 	
 	double fourChance = 0.2;
 	void* game = createGame(3, fourChance);
@@ -42,4 +103,39 @@ int main() {
 		printGame(std::cout, 3, game);
 	}
 	deleteGame(3, game);
+
+	Xoshiro256 swipeRandom(1);
+	checkSwipes<2, default_grid_bitset<2>>("2x2", 4, 1 << 16, swipeRandom);
+	checkSwipes<3, default_grid_bitset<3>>("3x3", 9, 1 << 16, swipeRandom);
+	checkSwipes<4, default_grid_bitset<4>>("4x4", 16, 1 << 16, swipeRandom);
+	checkSwipes<4, packed_words<16, 5>>("4x4 word packed", 16, 1 << 16, swipeRandom);
+	checkSwipes<4, packed_words<16, 4>>("4x4 (capped)", 15, 1 << 16, swipeRandom);
+	// tiles at the cap stay apart instead of merging into a tile the board cannot hold
+	CappedGridState<4, 15> saturated;
+	for (uint i = 0; i < 16; ++i) saturated.writeTile(i / 4, i % 4, 15);
+	CappedGridState<4, 15> saturatedSwiped = saturated;
+	bool saturatedKept = saturatedSwiped.swipe(0, -1) == 0 && saturatedSwiped == saturated && !saturated.hasMoves();
+	std::cout << "4x4 (capped) board of 32768s: " << (saturatedKept ? "kept" : "changed by a swipe") << std::endl;
+	checkSwipes<5, default_grid_bitset<5>>("5x5", 25, 1 << 16, swipeRandom);
+	checkSwipes<5, packed_words<25, 5>>("5x5 word packed", 25, 1 << 16, swipeRandom);
+	checkSwipes<8, default_grid_bitset<8>>("8x8", 64, 1 << 14, swipeRandom);
+
+	// random moves, to measure the simulator itself
+	GameBatch<4> batch(4096, fourChance);
+	Xoshiro256 moveRandom(randomSeed());
+	auto randomMove = [&](const GridState<4>&) { return MOVE_DIRECTIONS[randomBelow(moveRandom, 4)]; };
+	std::cout << "4x4 batch: " << batch.measureThroughput(randomMove, 1.0) << " games/sec" << std::endl;
+
+	// contended inserts into one shared node store
+	std::vector<GridState<4>> keys(1 << 18);
+	for (GridState<4>& key : keys) {
+		for (uint i = 0; i < 16; ++i) key.writeTile(i / 4, i % 4, randomBelow(moveRandom, 12));
+	}
+	// rows with more threads than the hardware has only take turns on its cores
+	uint hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	for (uint numThreads = 1; numThreads <= 64; numThreads *= 2) {
+		std::cout << "concurrent map, " << numThreads << "/" << hardwareThreads << " threads"
+			<< (numThreads > hardwareThreads ? " (oversubscribed)" : "") << ": "
+			<< measureConcurrentMap(keys, numThreads, 1 << 23) << " inserts/sec" << std::endl;
+	}
 }
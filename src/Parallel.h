@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Common.h"
+
+// Calls task(i) for every i in [0, count) on numThreads threads. Each thread starts with an equal share of the
+// indices and takes chunks from the front of it. A thread whose share has run out steals the back half of the
+// first other share that still has work, and stops once every share is empty.
+template<class TASK>
+void parallelFor(uint numThreads, uint64 count, TASK&& task, uint64 chunkSize = 64) {
+	if (numThreads <= 1 || count <= chunkSize) {
+		for (uint64 i = 0; i < count; ++i) task(i);
+		return;
+	}
+	struct Share {
+		std::mutex mutex;
+		uint64 begin;
+		uint64 end;
+	};
+	std::unique_ptr<Share[]> shares(new Share[numThreads]);
+	for (uint t = 0; t < numThreads; ++t) {
+		shares[t].begin = count * t / numThreads;
+		shares[t].end = count * (t + 1) / numThreads;
+	}
+
+	auto worker = [&](uint t) {
+		Share& own = shares[t];
+		for (;;) {
+			uint64 begin, end;
+			{
+				std::lock_guard<std::mutex> lock(own.mutex);
+				begin = own.begin;
+				end = std::min(own.end, begin + chunkSize);
+				own.begin = end;
+			}
+			if (begin < end) {
+				for (uint64 i = begin; i < end; ++i) task(i);
+				continue;
+			}
+			bool stole = false;
+			for (uint v = (t + 1) % numThreads; v != t && !stole; v = (v + 1) % numThreads) {
+				std::lock_guard<std::mutex> victimLock(shares[v].mutex);
+				uint64 remaining = shares[v].end - shares[v].begin;
+				if (remaining == 0) continue;
+				uint64 middle = shares[v].end - (remaining + 1) / 2;
+				std::lock_guard<std::mutex> ownLock(own.mutex);
+				own.begin = middle;
+				own.end = shares[v].end;
+				shares[v].end = middle;
+				stole = true;
+			}
+			if (!stole) return;
+		}
+	};
+	std::vector<std::thread> threads;
+	for (uint t = 1; t < numThreads; ++t) threads.emplace_back(worker, t);
+	worker(0);
+	for (std::thread& thread : threads) thread.join();
+}
+
+// Open addressing hash map from fixed width keys, such as GridState, to one atomic 64-bit value. Any number of
+// threads may insert and look up at once: a slot is claimed by a compare and swap on its tag, and lookups never
+// block except to wait for a key that is being written into a slot they probe. The map does not grow by itself.
+// An insert whose probe sequence is full fails, and the caller grows the map once no other thread is using it.
+// EdgeFreeTablebase keeps its nodes in one, with both scores of a node packed into the value so that they are read
+// and updated together. The parallel edge generation of the other tablebases uses one to find the first parent of
+// each new child in a batch.
+template<class K>
+class ConcurrentMap {
+public:
+	explicit ConcurrentMap(uint64 capacity = 1 << 16) { allocate(capacity); }
+	// Inserts key with value if it is not in the map. Returns the key's value and whether it was inserted, or a null
+	// value if the map must grow first.
+	std::pair<std::atomic<uint64>*, bool> insert(const K& key, uint64 value) { return insertInto(m_slots.get(), m_mask, key, value); }
+	// Records value for key, keeping the smaller of it and any value recorded before. False if the map must grow first.
+	bool insertMin(const K& key, uint64 value);
+	// The value stored for key, nullptr if there is none
+	std::atomic<uint64>* find(const K& key) { return const_cast<std::atomic<uint64>*>(std::as_const(*this).find(key)); }
+	const std::atomic<uint64>* find(const K& key) const;
+	// Must not run alongside any other member function
+	void clear(uint numThreads = 1);
+	// Doubles the capacity, rehashing on numThreads threads. Must not run alongside any other member function.
+	void grow(uint numThreads = 1);
+	// Number of keys, counted by a scan of every slot. Must not run alongside insert.
+	uint64 size() const;
+	uint64 capacity() const { return m_mask + 1; }
+	// Calls visit(key, value) for every key. Must not run alongside insert.
+	template<class VISIT>
+	void forEach(VISIT&& visit) const;
+	// Two scores packed into one value, so that a node's scores are read and written together
+	static uint64 packScores(std::pair<float, float> scores) { return (uint64(std::bit_cast<uint32>(scores.first)) << 32) | std::bit_cast<uint32>(scores.second); }
+	static std::pair<float, float> unpackScores(uint64 value) { return std::make_pair(std::bit_cast<float>(uint32(value >> 32)), std::bit_cast<float>(uint32(value))); }
+private:
+	// slots claimed by an insert that has not written its key yet, all other tags of used slots have bit 1 set
+	static constexpr uint32 EMPTY = 0;
+	static constexpr uint32 BUSY = 1;
+	// linear probing gives up after this many slots, which at a sensible load only happens when the map is nearly full
+	static constexpr uint64 MAX_PROBES = 256;
+	struct Slot {
+		std::atomic<uint32> tag;
+		K key;
+		std::atomic<uint64> value;
+	};
+	static uint64 hashOf(const K& key) { return std::hash<K>()(key); }
+	static uint32 tagOf(uint64 hash) { return uint32(hash >> 32) | 2; }
+	static uint32 waitForKey(const Slot& slot, uint32 tag);
+	static std::pair<std::atomic<uint64>*, bool> insertInto(Slot* slots, uint64 mask, const K& key, uint64 value);
+	void allocate(uint64 capacity);
+	std::unique_ptr<Slot[]> m_slots;
+	uint64 m_mask;
+};
+
+template<class K>
+bool ConcurrentMap<K>::insertMin(const K& key, uint64 value) {
+	auto [slot, inserted] = insert(key, value);
+	if (slot == nullptr) return false;
+	if (!inserted) {
+		uint64 current = slot->load(std::memory_order_relaxed);
+		while (value < current && !slot->compare_exchange_weak(current, value, std::memory_order_relaxed));
+	}
+	return true;
+}
+
+template<class K>
+uint32 ConcurrentMap<K>::waitForKey(const Slot& slot, uint32 tag) {
+	while (tag == BUSY) {
+		std::this_thread::yield();
+		tag = slot.tag.load(std::memory_order_acquire);
+	}
+	return tag;
+}
+
+template<class K>
+std::pair<std::atomic<uint64>*, bool> ConcurrentMap<K>::insertInto(Slot* slots, uint64 mask, const K& key, uint64 value) {
+	uint64 hash = hashOf(key);
+	uint32 keyTag = tagOf(hash);
+	uint64 maxProbes = std::min(mask + 1, MAX_PROBES);
+	for (uint64 probe = 0; probe < maxProbes; ++probe) {
+		Slot& slot = slots[(hash + probe) & mask];
+		uint32 tag = slot.tag.load(std::memory_order_acquire);
+		if (tag == EMPTY) {
+			if (slot.tag.compare_exchange_strong(tag, BUSY, std::memory_order_acquire)) {
+				slot.key = key;
+				slot.value.store(value, std::memory_order_relaxed);
+				slot.tag.store(keyTag, std::memory_order_release);
+				return std::make_pair(&slot.value, true);
+			}
+		}
+		// the slot is taken, possibly by another thread inserting this same key
+		tag = waitForKey(slot, tag);
+		if (tag == keyTag && slot.key == key) return std::make_pair(&slot.value, false);
+	}
+	return std::make_pair(nullptr, false);
+}
+
+template<class K>
+const std::atomic<uint64>* ConcurrentMap<K>::find(const K& key) const {
+	uint64 hash = hashOf(key);
+	uint32 keyTag = tagOf(hash);
+	uint64 maxProbes = std::min(capacity(), MAX_PROBES);
+	for (uint64 probe = 0; probe < maxProbes; ++probe) {
+		const Slot& slot = m_slots[(hash + probe) & m_mask];
+		uint32 tag = waitForKey(slot, slot.tag.load(std::memory_order_acquire));
+		if (tag == EMPTY) return nullptr;
+		if (tag == keyTag && slot.key == key) return &slot.value;
+	}
+	return nullptr;
+}
+
+template<class K>
+void ConcurrentMap<K>::allocate(uint64 capacity) {
+	capacity = std::bit_ceil(std::max<uint64>(capacity, 2));
+	m_slots.reset(new Slot[capacity]());
+	m_mask = capacity - 1;
+}
+
+template<class K>
+void ConcurrentMap<K>::clear(uint numThreads) {
+	parallelFor(numThreads, capacity(), [this](uint64 i) { m_slots[i].tag.store(EMPTY, std::memory_order_relaxed); }, 4096);
+}
+
+template<class K>
+void ConcurrentMap<K>::grow(uint numThreads) {
+	std::unique_ptr<Slot[]> oldSlots = std::move(m_slots);
+	uint64 oldCapacity = m_mask + 1;
+	allocate(2 * oldCapacity);
+	std::atomic<bool> overflowed = false;
+	parallelFor(numThreads, oldCapacity, [this, &oldSlots, &overflowed](uint64 i) {
+		const Slot& slot = oldSlots[i];
+		if (slot.tag.load(std::memory_order_relaxed) == EMPTY) return;
+		if (insertInto(m_slots.get(), m_mask, slot.key, slot.value.load(std::memory_order_relaxed)).first == nullptr) {
+			overflowed = true;
+		}
+	}, 4096);
+	if (overflowed) throw std::runtime_error("ConcurrentMap probe sequence overflowed while growing");
+}
+
+template<class K>
+uint64 ConcurrentMap<K>::size() const {
+	uint64 count = 0;
+	for (uint64 i = 0; i < capacity(); ++i) count += m_slots[i].tag.load(std::memory_order_relaxed) != EMPTY;
+	return count;
+}
+
+template<class K>
+template<class VISIT>
+void ConcurrentMap<K>::forEach(VISIT&& visit) const {
+	for (uint64 i = 0; i < capacity(); ++i) {
+		const Slot& slot = m_slots[i];
+		if (slot.tag.load(std::memory_order_acquire) != EMPTY) visit(slot.key, slot.value.load(std::memory_order_relaxed));
+	}
+}
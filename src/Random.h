@@ -0,0 +1,77 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <random>
+
+#include "Common.h"
+
+// xoshiro256** (Blackman and Vigna), seeded through splitmix64. Small, fast and a UniformRandomBitGenerator,
+// so one can be kept per thread or per simulation instead of sharing a global engine.
+class Xoshiro256 {
+public:
+	using result_type = uint64;
+
+	explicit Xoshiro256(uint64 seed = 0) { this->seed(seed); }
+	void seed(uint64 seed) {
+		for (uint64& s : m_state) {
+			seed += 0x9e3779b97f4a7c15ull;
+			uint64 z = seed;
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+			s = z ^ (z >> 31);
+		}
+	}
+	static constexpr result_type min() { return 0; }
+	static constexpr result_type max() { return UINT64_MAX; }
+	result_type operator()() {
+		uint64 result = std::rotl(m_state[1] * 5, 7) * 9;
+		uint64 t = m_state[1] << 17;
+		m_state[2] ^= m_state[0];
+		m_state[3] ^= m_state[1];
+		m_state[1] ^= m_state[2];
+		m_state[0] ^= m_state[3];
+		m_state[2] ^= t;
+		m_state[3] = std::rotl(m_state[3], 45);
+		return result;
+	}
+private:
+	uint64 m_state[4];
+};
+
+// Seed drawn from the system's entropy source
+inline uint64 randomSeed() {
+	std::random_device device;
+	return (uint64(device()) << 32) ^ device();
+}
+
+// Generator owned by the calling thread, randomly seeded on first use
+inline Xoshiro256& threadRandom() {
+	thread_local Xoshiro256 generator(randomSeed());
+	return generator;
+}
+
+inline void seedThreadRandom(uint64 seed) {
+	threadRandom().seed(seed);
+}
+
+// Uniform integer in [0, bound)
+template<class RNG>
+uint randomBelow(RNG& random, uint bound) {
+	return std::uniform_int_distribution<uint>(0, bound - 1)(random);
+}
+
+inline uint randomBelow(Xoshiro256& random, uint bound) {
+	// multiply-shift, whose bias of at most bound / 2^32 is negligible for board sized bounds
+	return uint((uint64(uint32(random() >> 32)) * bound) >> 32);
+}
+
+// Uniform float in [0, 1)
+template<class RNG>
+float randomUnitFloat(RNG& random) {
+	return std::uniform_real_distribution<float>()(random);
+}
+
+inline float randomUnitFloat(Xoshiro256& random) {
+	return float(random() >> 40) * 0x1.0p-24f;
+}
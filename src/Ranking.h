@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include "Common.h"
+#include "Model.h"
+
+// Number of grids with N * N tiles of at most MAX_TILE, if it fits in 64 bits, otherwise 0
+template<uint N, uint MAX_TILE>
+constexpr uint64 numRankableGrids() {
+	uint64 count = 1;
+	for (uint i = 0; i < N * N; ++i) {
+		if (count > UINT64_MAX / (MAX_TILE + 1)) return 0;
+		count *= MAX_TILE + 1;
+	}
+	return count;
+}
+
+// Perfect ranking of every grid whose tiles are at most MAX_TILE, the win tile by default. Grids are numbered by
+// ascending tile sum, so each tile sum layer is a contiguous range of indices, and in lexicographic order of their
+// tiles within a layer. Ranks are computed from the number of ways to fill the remaining tiles up to a given sum.
+template<uint N, uint MAX_TILE = N * N + 1>
+class StateRanking {
+public:
+	static_assert(numRankableGrids<N, MAX_TILE>() != 0, "too many grids to rank in 64 bits");
+	static constexpr uint NUM_TILES = N * N;
+	// Tile sums counted in 2s, the value of the smallest tile
+	static constexpr uint64 MAX_SUM = uint64(NUM_TILES) << (MAX_TILE - 1);
+
+	StateRanking();
+	uint64 numStates() const { return m_layerOffsets.back(); }
+	uint64 rank(const GridState<N>& state) const;
+	GridState<N> unrank(uint64 index) const;
+	// Indices of the grids whose tile sum is 2 * halfSum are [layerBegin(halfSum), layerEnd(halfSum))
+	uint64 layerBegin(uint64 halfSum) const { return m_layerOffsets[halfSum]; }
+	uint64 layerEnd(uint64 halfSum) const { return m_layerOffsets[halfSum + 1]; }
+private:
+	static uint64 halfValue(uint tile) { return tile == 0 ? 0 : uint64(1) << (tile - 1); }
+	// Ways to fill numTiles tiles so that they sum to 2 * halfSum
+	uint64 count(uint numTiles, uint64 halfSum) const { return m_counts[numTiles * (MAX_SUM + 1) + halfSum]; }
+	std::vector<uint64> m_counts;
+	std::vector<uint64> m_layerOffsets;
+};
+
+template<uint N, uint MAX_TILE>
+StateRanking<N, MAX_TILE>::StateRanking() : m_counts((NUM_TILES + 1) * (MAX_SUM + 1), 0), m_layerOffsets(MAX_SUM + 2, 0) {
+	m_counts[0] = 1;
+	for (uint numTiles = 1; numTiles <= NUM_TILES; ++numTiles) {
+		for (uint64 halfSum = 0; halfSum <= MAX_SUM; ++halfSum) {
+			uint64 ways = 0;
+			for (uint tile = 0; tile <= MAX_TILE && halfValue(tile) <= halfSum; ++tile) {
+				ways += count(numTiles - 1, halfSum - halfValue(tile));
+			}
+			m_counts[numTiles * (MAX_SUM + 1) + halfSum] = ways;
+		}
+	}
+	for (uint64 halfSum = 0; halfSum <= MAX_SUM; ++halfSum) {
+		m_layerOffsets[halfSum + 1] = m_layerOffsets[halfSum] + count(NUM_TILES, halfSum);
+	}
+}
+
+template<uint N, uint MAX_TILE>
+uint64 StateRanking<N, MAX_TILE>::rank(const GridState<N>& state) const {
+	uint64 remaining = state.tileSum() / 2;
+	assert(remaining <= MAX_SUM);
+	uint64 index = layerBegin(remaining);
+	for (uint i = 0; i < NUM_TILES; ++i) {
+		uint tile = state.readTile(i / N, i % N);
+		assert(tile <= MAX_TILE);
+		// every grid that agrees on the earlier tiles and has a smaller tile here comes first
+		for (uint smaller = 0; smaller < tile && halfValue(smaller) <= remaining; ++smaller) {
+			index += count(NUM_TILES - 1 - i, remaining - halfValue(smaller));
+		}
+		remaining -= halfValue(tile);
+	}
+	return index;
+}
+
+template<uint N, uint MAX_TILE>
+GridState<N> StateRanking<N, MAX_TILE>::unrank(uint64 index) const {
+	assert(index < numStates());
+	uint64 remaining = uint64(std::upper_bound(m_layerOffsets.begin(), m_layerOffsets.end(), index) - m_layerOffsets.begin()) - 1;
+	index -= layerBegin(remaining);
+	GridState<N> state;
+	for (uint i = 0; i < NUM_TILES; ++i) {
+		uint tile = 0;
+		for (;; ++tile) {
+			assert(tile <= MAX_TILE && halfValue(tile) <= remaining);
+			uint64 ways = count(NUM_TILES - 1 - i, remaining - halfValue(tile));
+			if (index < ways) break;
+			index -= ways;
+		}
+		state.writeTile(i / N, i % N, tile);
+		remaining -= halfValue(tile);
+	}
+	return state;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <limits>
+
+#include "Common.h"
+
+// Converts scores to and from the type a tablebase stores them in. Scores are win probabilities in [0, 1], or -1
+// while unknown. Unsigned integer types hold a score as a fixed point fraction of their largest value less one,
+// and their largest value stands for an unknown score.
+template<class SCORE_T>
+struct ScoreCodec {
+	static_assert(std::unsigned_integral<SCORE_T>, "scores are stored as float or as an unsigned integer");
+	static constexpr SCORE_T UNKNOWN = std::numeric_limits<SCORE_T>::max();
+	static constexpr float SCALE = float(UNKNOWN - 1);
+	// Largest difference between a score and the score it is stored as
+	static constexpr float MAX_ERROR = 0.5f / SCALE;
+	static SCORE_T encode(float score) { return score == -1.0f ? UNKNOWN : SCORE_T(std::lround(std::clamp(score, 0.0f, 1.0f) * SCALE)); }
+	static float decode(SCORE_T stored) { return stored == UNKNOWN ? -1.0f : stored / SCALE; }
+};
+
+template<>
+struct ScoreCodec<float> {
+	static constexpr float MAX_ERROR = 0.0f;
+	static float encode(float score) { return score; }
+	static float decode(float stored) { return stored; }
+};
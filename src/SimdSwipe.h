@@ -0,0 +1,91 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+#include "Common.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_SWIPE 1
+#include <smmintrin.h>
+#if _MSC_VER
+#include <intrin.h>
+#define SIMD_SWIPE_TARGET
+#else
+#define SIMD_SWIPE_TARGET __attribute__((target("sse4.1")))
+#endif
+#else
+#define SIMD_SWIPE 0
+#endif
+
+// Tiles of up to 16 lines, one byte lane per line. cells[k][line] is the k-th tile of each line.
+template<uint N>
+struct LineMatrix {
+	static_assert(N <= 16, "a line matrix holds at most 16 lines");
+	alignas(16) uint8_t cells[N][16];
+};
+
+#if SIMD_SWIPE
+inline bool simdSwipeSupported() {
+	static const bool supported = [] {
+#if _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		return ((info[2] >> 19) & 1) != 0;
+#else
+		return __builtin_cpu_supports("sse4.1") != 0;
+#endif
+	}();
+	return supported;
+}
+
+// Slides all lines of the matrix at once, towards k = 0 or towards k = N - 1, and returns the sum of the
+// tiles created by merges. Follows GridState::slideRow: a merged tile does not merge again with the tile
+// right behind it, but it can once an empty cell came in between, and two tiles of maxTile do not merge.
+template<uint N>
+SIMD_SWIPE_TARGET uint simdSlideLines(const LineMatrix<N>& lines, bool towardEnd, uint maxTile, LineMatrix<N>& slid) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i saturated = _mm_set1_epi8(char(maxTile));
+	__m128i out[N];
+	for (uint i = 0; i < N; ++i) out[i] = zero;
+	// last tile written to each line, number of tiles written and whether that tile came from a merge
+	__m128i top = zero;
+	__m128i count = zero;
+	__m128i fused = zero;
+	uint sumOfNewTiles = 0;
+	for (uint step = 0; step < N; ++step) {
+		uint k = towardEnd ? N - 1 - step : step;
+		__m128i tile = _mm_load_si128(reinterpret_cast<const __m128i*>(lines.cells[k]));
+		__m128i nonEmpty = _mm_xor_si128(_mm_cmpeq_epi8(tile, zero), _mm_set1_epi8(-1));
+		__m128i merge = _mm_andnot_si128(fused, _mm_and_si128(nonEmpty, _mm_cmpeq_epi8(top, tile)));
+		merge = _mm_andnot_si128(_mm_cmpeq_epi8(tile, saturated), merge);
+		__m128i push = _mm_andnot_si128(merge, nonEmpty);
+		count = _mm_sub_epi8(count, push);
+		top = _mm_blendv_epi8(top, tile, push);
+		top = _mm_blendv_epi8(top, _mm_add_epi8(tile, one), merge);
+		fused = merge;
+
+		uint mergeMask = uint(_mm_movemask_epi8(merge));
+		if (mergeMask) {
+			alignas(16) uint8_t merged[16];
+			_mm_store_si128(reinterpret_cast<__m128i*>(merged), top);
+			for (; mergeMask; mergeMask &= mergeMask - 1) {
+				sumOfNewTiles += (1u << merged[std::countr_zero(mergeMask)]);
+			}
+		}
+
+		__m128i position = _mm_sub_epi8(count, one);
+		for (uint i = 0; i <= step; ++i) {
+			__m128i write = _mm_and_si128(nonEmpty, _mm_cmpeq_epi8(position, _mm_set1_epi8(char(i))));
+			out[i] = _mm_blendv_epi8(out[i], top, write);
+		}
+	}
+	for (uint i = 0; i < N; ++i) {
+		_mm_store_si128(reinterpret_cast<__m128i*>(slid.cells[towardEnd ? N - 1 - i : i]), out[i]);
+	}
+	return sumOfNewTiles;
+}
+#else
+inline bool simdSwipeSupported() { return false; }
+#endif
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Common.h"
+
+// A FIFO queue of trivially copyable items that keeps at most about memoryItems of them in memory. Once more are
+// queued, the oldest queued items are appended to the spill file a segment at a time, and read back a segment at a
+// time when they reach the front.
+// Items are numbered by the order they were pushed in. A cursor of the head, the tail and the number of the first
+// item in the file is enough to reopen the queue from the file once checkpoint has written every item to it.
+// Until the cursor a checkpoint returns is committed, the queue may have to be reopened with the one before it, so
+// nothing that cursor points to is overwritten. The file is only appended to, and a checkpoint moves the queued items
+// to its beginning once they fit in front of the first item the previous cursor had not popped.
+template<class T>
+class SpillQueue {
+public:
+	static_assert(std::is_trivially_copyable_v<T>, "SpillQueue writes items to its file as bytes");
+	struct Cursor {
+		uint64 head = 0;
+		uint64 tail = 0;
+		uint64 fileBase = 0;
+	};
+	SpillQueue(const std::string& path, uint64 memoryItems);
+	SpillQueue(const SpillQueue&) = delete;
+	SpillQueue& operator=(const SpillQueue&) = delete;
+	void push(const T& item);
+	T pop();
+	bool empty() const { return m_head == m_tail; }
+	uint64 size() const { return m_tail - m_head; }
+	// Writes every queued item that is only in memory to the file and returns the cursor to reopen the queue with.
+	// The cursor returned before has to be committed by then.
+	Cursor checkpoint();
+	// Replaces the queue with the one a checkpoint of a queue on the same file returned cursor for
+	void restore(const Cursor& cursor);
+private:
+	// items moved between memory and the file at once
+	static constexpr uint64 SEGMENT_ITEMS = 1 << 16;
+	void writeItems(uint64 count);
+	void readSegment();
+	void moveToFileStart();
+	std::string m_path;
+	std::fstream m_file;
+	uint64 m_memoryItems;
+	uint64 m_head = 0;
+	uint64 m_tail = 0;
+	// the file holds items [m_fileBase, m_fileEnd)
+	uint64 m_fileBase = 0;
+	uint64 m_fileEnd = 0;
+	// the cursor returned by the last checkpoint, or restored
+	Cursor m_committed;
+	// items [m_head, m_head + m_front.size()), read from the file
+	std::deque<T> m_front;
+	// items [m_fileEnd, m_tail), which are not in the file yet
+	std::deque<T> m_back;
+};
+
+template<class T>
+SpillQueue<T>::SpillQueue(const std::string& path, uint64 memoryItems) : m_path(path), m_memoryItems(std::max(memoryItems, SEGMENT_ITEMS)) {
+	if (!std::filesystem::exists(path)) std::ofstream(path, std::ios::binary);
+	m_file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+	if (!m_file) throw std::runtime_error("failed to open queue file " + path);
+}
+
+template<class T>
+void SpillQueue<T>::push(const T& item) {
+	m_back.push_back(item);
+	++m_tail;
+	if (m_back.size() > m_memoryItems) writeItems(SEGMENT_ITEMS);
+}
+
+template<class T>
+T SpillQueue<T>::pop() {
+	if (empty()) throw std::logic_error("pop from an empty queue");
+	if (m_front.empty() && m_head < m_fileEnd) readSegment();
+	T item;
+	if (!m_front.empty()) {
+		item = m_front.front();
+		m_front.pop_front();
+	}
+	else {
+		// every item in the file has been popped, so the item is not written at all
+		item = m_back.front();
+		m_back.pop_front();
+		m_fileEnd = m_head + 1;
+	}
+	++m_head;
+	return item;
+}
+
+template<class T>
+typename SpillQueue<T>::Cursor SpillQueue<T>::checkpoint() {
+	if (size() <= m_committed.head - m_committed.fileBase) moveToFileStart();
+	writeItems(m_back.size());
+	m_file.flush();
+	if (!m_file) throw std::runtime_error("failed to write queue file " + m_path);
+	if (empty() && m_committed.head == m_committed.tail) std::filesystem::resize_file(m_path, 0);
+	m_committed = Cursor{ m_head, m_tail, m_fileBase };
+	return m_committed;
+}
+
+template<class T>
+void SpillQueue<T>::restore(const Cursor& cursor) {
+	if (cursor.fileBase > cursor.head || cursor.head > cursor.tail) throw std::runtime_error("invalid cursor for queue file " + m_path);
+	if (std::filesystem::file_size(m_path) < (cursor.tail - cursor.fileBase) * sizeof(T)) {
+		throw std::runtime_error("queue file " + m_path + " is shorter than its cursor");
+	}
+	m_head = cursor.head;
+	m_tail = cursor.tail;
+	m_fileBase = cursor.fileBase;
+	m_fileEnd = cursor.tail;
+	m_committed = cursor;
+	m_front.clear();
+	m_back.clear();
+}
+
+// Appends the oldest count items that are only in memory to the file
+template<class T>
+void SpillQueue<T>::writeItems(uint64 count) {
+	if (count == 0) return;
+	m_file.seekp((m_fileEnd - m_fileBase) * sizeof(T));
+	for (uint64 i = 0; i < count; ++i) m_file.write(reinterpret_cast<const char*>(&m_back[i]), sizeof(T));
+	if (!m_file) throw std::runtime_error("failed to write queue file " + m_path);
+	m_back.erase(m_back.begin(), m_back.begin() + count);
+	m_fileEnd += count;
+}
+
+template<class T>
+void SpillQueue<T>::readSegment() {
+	uint64 count = std::min(SEGMENT_ITEMS, m_fileEnd - m_head);
+	m_front.resize(count);
+	m_file.seekg((m_head - m_fileBase) * sizeof(T));
+	for (T& item : m_front) m_file.read(reinterpret_cast<char*>(&item), sizeof(T));
+	if (!m_file) throw std::runtime_error("failed to read queue file " + m_path);
+}
+
+// Moves the queued items that are in the file to its beginning
+template<class T>
+void SpillQueue<T>::moveToFileStart() {
+	std::vector<T> segment;
+	// the items only move towards the beginning, so a segment is read before anything is written over it
+	for (uint64 item = m_head; item < m_fileEnd; item += segment.size()) {
+		segment.resize(std::min(SEGMENT_ITEMS, m_fileEnd - item));
+		m_file.seekg((item - m_fileBase) * sizeof(T));
+		m_file.read(reinterpret_cast<char*>(segment.data()), segment.size() * sizeof(T));
+		m_file.seekp((item - m_head) * sizeof(T));
+		m_file.write(reinterpret_cast<const char*>(segment.data()), segment.size() * sizeof(T));
+	}
+	if (!m_file) throw std::runtime_error("failed to move items in queue file " + m_path);
+	m_fileBase = m_head;
+}
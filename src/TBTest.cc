@@ -1,13 +1,16 @@
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <csignal>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <iostream>
-#include <random>
+#include <memory>
+#include <thread>
 
 #include "Tablebase.h"
 
-std::mt19937 s_random((std::random_device())());
-
 std::atomic<bool> s_interrupted = false;
 
 extern "C" void interruptHandler(int sig) {
@@ -16,14 +19,325 @@ extern "C" void interruptHandler(int sig) {
 	}
 }
 
+// Steps through every 2x2 grid with tiles up to the win tile, false once it wraps around to the empty grid
+bool nextGrid(GridState<2>& state) {
+	for (uint i = 0; i < 4; ++i) {
+		uint tile = state.readTile(i / 2, i % 2) + 1;
+		state.writeTile(i / 2, i % 2, tile == 6 ? 0 : tile);
+		if (tile != 6) return true;
+	}
+	return false;
+}
+
+// Counts the nodes of the exact 2x2 tablebase on which tablebase gives a score further than tolerance from the exact
+// final score, or a best move into a child with a different intermediate score than the exact best move. Equally good
+// moves may be picked in another order, e.g. by a tablebase that stores one node per symmetry class.
+template<class TABLEBASE>
+uint countMismatches(const InMemoryTablebase<2>& exact, const TABLEBASE& tablebase, float tolerance = 1e-6f) {
+	ankerl::unordered_dense::map<GridState<2>, float> interScores;
+	exact.forEachNode([&](const GridState<2>& node, float, float interScore) { interScores[node] = interScore; });
+	auto moveScore = [&](GridState<2> node, std::pair<int, int> move) {
+		if (move.first == -1 && move.second == -1) return -1.0f;
+		node.swipe(move.first, move.second);
+		return interScores.at(node);
+	};
+	uint mismatches = 0;
+	exact.forEachNode([&](const GridState<2>& node, float finalScore, float) {
+		auto exactMove = exact.bestMove(node);
+		auto move = tablebase.bestMove(node);
+		bool sameMove = move == exactMove || std::abs(moveScore(node, move) - moveScore(node, exactMove)) <= tolerance;
+		if (std::abs(tablebase.query(node) - finalScore) > tolerance || !sameMove) ++mismatches;
+	});
+	return mismatches;
+}
+
+// Checks a 2x2 tablebase built another way against the exact one on every node
+template<class TABLEBASE>
+void compareNodes(const InMemoryTablebase<2>& exact, const TABLEBASE& tablebase, const char* name) {
+	std::cout << name << ": " << countMismatches(exact, tablebase) << " nodes differ" << std::endl;
+}
+
+// Measures how far the scores of a 2x2 tablebase stored as SCORE_T are from full precision, and how many best
+// moves they change, over every node. Each score is rounded once, so the max error should be at most one rounding.
+template<class SCORE_T, template<uint, class> class TABLEBASE>
+void compareQuantized(const InMemoryTablebase<2>& exact, const char* name) {
+	TABLEBASE<2, SCORE_T> quantized(0.2f);
+	quantized.init();
+	float maxError = 0;
+	uint numNodes = 0;
+	uint changedMoves = 0;
+	GridState<2> state;
+	do {
+		if (exact.query(state) != -1.0f) {
+			++numNodes;
+			maxError = std::max(maxError, std::abs(exact.query(state) - quantized.query(state)));
+			if (exact.bestMove(state) != quantized.bestMove(state)) ++changedMoves;
+		}
+	} while (nextGrid(state));
+	std::cout << name << " scores: max error " << maxError << " (" << ScoreCodec<SCORE_T>::MAX_ERROR << " per rounding), "
+		<< changedMoves << " of " << numNodes << " best moves changed" << std::endl;
+}
+
+// Writes a 2x2 tablebase to a file and checks that reading it back gives the same queries and best moves
+template<class FILE_TABLEBASE>
+void compareFile(const InMemoryTablebase<2>& tablebase, const std::string& path, const char* name) {
+	FILE_TABLEBASE::write(path, tablebase);
+	FILE_TABLEBASE file(path);
+	uint mismatches = 0;
+	GridState<2> state;
+	do {
+		if (tablebase.query(state) != file.query(state) || tablebase.bestMove(state) != file.bestMove(state)) ++mismatches;
+	} while (nextGrid(state));
+	std::cout << name << ": " << file.numNodes() << " nodes in " << std::filesystem::file_size(path) << " bytes, "
+		<< mismatches << " grids differ" << std::endl;
+}
+
+// Archives a 4x4 tablebase generated a few moves deep, whose keys are wider than 64 bits, and checks every node
+void compareWideArchive(const std::string& path) {
+	InMemoryTablebase<4> tablebase(0.2f);
+	tablebase.init(UINT64_MAX, 4);
+	ArchiveTablebase<4>::write(path, tablebase);
+	ArchiveTablebase<4> archive(path);
+	uint mismatches = 0;
+	tablebase.forEachNode([&](const GridState<4>& node, float finalScore, float) {
+		if (archive.query(node) != finalScore) ++mismatches;
+	});
+	std::cout << "archived 4x4 tablebase: " << archive.numNodes() << " nodes in " << std::filesystem::file_size(path) << " bytes, "
+		<< mismatches << " nodes differ" << std::endl;
+}
+
+// Checks a lazy 2x2 tablebase with a cache smaller than the tablebase against the full one on every node
+void compareLazy(const InMemoryTablebase<2>& tablebase, uint64 cacheEntries) {
+	LazyTablebase<2> lazy(0.2f, cacheEntries);
+	uint mismatches = countMismatches(tablebase, lazy, 1e-5f);
+	std::cout << "lazy tablebase: " << lazy.numCached() << " nodes cached, " << mismatches << " nodes differ" << std::endl;
+}
+
+// Builds a 2x2 tablebase a few actions at a time, restarting from a snapshot after every step as if interrupted
+void compareResumed(const InMemoryTablebase<2>& tablebase, const std::string& path, bool dependencyCounting = false) {
+	auto resumed = std::make_unique<InMemoryTablebase<2>>(0.2f);
+	uint steps = 0;
+	for (bool done = false; !done; ++steps) {
+		done = resumed->partialInit(100);
+		resumed->saveSnapshot(path);
+		resumed = std::make_unique<InMemoryTablebase<2>>(0.2f);
+		resumed->setDependencyCounting(dependencyCounting);
+		resumed->loadSnapshot(path);
+	}
+	uint mismatches = countMismatches(tablebase, *resumed, 0.0f);
+	std::cout << "resumed tablebase" << (dependencyCounting ? " with dependency counting" : "") << ": " << steps << " snapshots, " << mismatches << " nodes differ" << std::endl;
+}
+
+// Same with 16-bit scores, whose full precision scores of the layers in progress must survive the snapshots for the
+// resumed tablebase to round exactly as one built in a single run
+void compareResumedQuantized(const std::string& path) {
+	InMemoryTablebase<2, uint16_t> tablebase(0.2f);
+	tablebase.init();
+	auto resumed = std::make_unique<InMemoryTablebase<2, uint16_t>>(0.2f);
+	uint steps = 0;
+	for (bool done = false; !done; ++steps) {
+		done = resumed->partialInit(100);
+		resumed->saveSnapshot(path);
+		resumed = std::make_unique<InMemoryTablebase<2, uint16_t>>(0.2f);
+		resumed->loadSnapshot(path);
+	}
+	uint mismatches = 0;
+	tablebase.forEachNode([&](const GridState<2>& node, float finalScore, float) {
+		if (resumed->query(node) != finalScore) ++mismatches;
+	});
+	std::cout << "resumed 16-bit tablebase: " << steps << " snapshots, " << mismatches << " nodes differ" << std::endl;
+}
+
+// Removes a SQLite tablebase and its queue files
+void removeSqlite(const std::string& path) {
+	std::filesystem::remove(path);
+	std::filesystem::remove(path + ".edge_queue");
+	std::filesystem::remove(path + ".score_queue");
+}
+
+// Scores a fresh 2x2 SQLite tablebase with dependency counting and checks it against the full one on every node
+void compareCounted(const InMemoryTablebase<2>& tablebase, const std::string& path) {
+	removeSqlite(path);
+	SqliteTablebase<2> counted(0.2f, path);
+	counted.setDependencyCounting(true);
+	counted.init();
+	compareNodes(tablebase, counted, "dependency counted tablebase");
+}
+
+// Replaces every grid in column of table with the same grid in the layout databases were written in before
+// grid_layout_version was recorded
+void rewriteLegacyGrids(sqlite3* db, const std::string& table, const std::string& column) {
+	using LegacyGrid = GridState<4, packed_bitset<tileLog2(17) * 16>>;
+	sqlite3_stmt* select;
+	CHECK_RETURN_CODE(sqlite3_prepare_v2(db, ("SELECT DISTINCT " + column + " FROM " + table + ";").c_str(), -1, &select, nullptr), SQLITE_OK);
+	std::vector<GridState<4>> grids;
+	while (sqlite3_step(select) == SQLITE_ROW) {
+		std::memcpy(grids.emplace_back().gridData(), sqlite3_column_blob(select, 0), GridState<4>::GRID_DATA_BYTES);
+	}
+	CHECK_RETURN_CODE(sqlite3_finalize(select), SQLITE_OK);
+	sqlite3_stmt* update;
+	std::string updateSql = "UPDATE " + table + " SET " + column + " = ? WHERE " + column + " = ?;";
+	CHECK_RETURN_CODE(sqlite3_prepare_v2(db, updateSql.c_str(), -1, &update, nullptr), SQLITE_OK);
+	for (const GridState<4>& grid : grids) {
+		LegacyGrid legacy;
+		for (uint i = 0; i < 16; ++i) legacy.writeTile(i / 4, i % 4, grid.readTile(i / 4, i % 4));
+		CHECK_RETURN_CODE(sqlite3_bind_blob(update, 1, legacy.gridData(), LegacyGrid::GRID_DATA_BYTES, SQLITE_STATIC), SQLITE_OK);
+		CHECK_RETURN_CODE(sqlite3_bind_blob(update, 2, grid.gridData(), GridState<4>::GRID_DATA_BYTES, SQLITE_STATIC), SQLITE_OK);
+		CHECK_RETURN_CODE(sqlite3_step(update), SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_reset(update), SQLITE_OK);
+	}
+	CHECK_RETURN_CODE(sqlite3_finalize(update), SQLITE_OK);
+}
+
+// Generates a 4x4 SQLite tablebase a few moves deep, rewrites it as a database from before 4x4 grids were word
+// packed, then scores it and checks every node against an in-memory tablebase of the same depth
+void compareLegacyLayout(const std::string& path) {
+	removeSqlite(path);
+	{
+		SqliteTablebase<4> generated(0.2f, path);
+		generated.partialInit(UINT64_MAX, 2);
+	}
+	sqlite3* db;
+	CHECK_RETURN_CODE(sqlite3_open(path.c_str(), &db), SQLITE_OK);
+	rewriteLegacyGrids(db, "node", "grid_state");
+	rewriteLegacyGrids(db, "edge", "start_state");
+	rewriteLegacyGrids(db, "edge", "end_state");
+	CHECK_RETURN_CODE(sqlite3_exec(db, "DELETE FROM config WHERE prop_name = 'grid_layout_version';", nullptr, nullptr, nullptr), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_close(db), SQLITE_OK);
+
+	SqliteTablebase<4> legacy(0.2f, path);
+	while (!legacy.partialInit(UINT64_MAX, 2));
+	InMemoryTablebase<4> exact(0.2f);
+	exact.init(UINT64_MAX, 2);
+	ankerl::unordered_dense::map<GridState<4>, std::pair<float, float>> exactScores;
+	exact.forEachNode([&](const GridState<4>& node, float finalScore, float interScore) { exactScores[node] = std::make_pair(finalScore, interScore); });
+	uint numNodes = 0, numScored = 0, mismatches = 0;
+	legacy.forEachNode([&](const GridState<4>& node, float finalScore, float interScore) {
+		++numNodes;
+		numScored += finalScore != -1.0f;
+		auto it = exactScores.find(node);
+		if (it == exactScores.end() || std::abs(it->second.first - finalScore) > 1e-6f || std::abs(it->second.second - interScore) > 1e-6f) ++mismatches;
+	});
+	mismatches += uint(exactScores.size() - std::min<size_t>(numNodes, exactScores.size()));
+	std::cout << "legacy layout 4x4 tablebase: " << numScored << " of " << numNodes << " nodes scored, " << mismatches << " nodes differ" << std::endl;
+}
+
+// Builds a fresh 2x2 SQLite tablebase with dependency counting, actions at a time, reopening it after every step as
+// if interrupted, and checks it against the full one
+void compareCountedResumed(const InMemoryTablebase<2>& tablebase, const std::string& path, uint64 actions) {
+	removeSqlite(path);
+	uint steps = 0;
+	for (bool done = false; !done; ++steps) {
+		SqliteTablebase<2> counted(0.2f, path);
+		counted.setDependencyCounting(true);
+		done = counted.partialInit(actions);
+	}
+	SqliteTablebase<2> counted(0.2f, path);
+	uint mismatches = countMismatches(tablebase, counted);
+	std::cout << "dependency counted tablebase resumed every " << actions << " actions: " << steps << " reopenings, "
+		<< mismatches << " nodes differ" << std::endl;
+}
+
+// Builds a fresh 2x2 SQLite tablebase with bulk writes, a few actions at a time, reopening it after every step as if
+// interrupted, and checks it against the full one
+void compareBulk(const InMemoryTablebase<2>& tablebase, const std::string& path) {
+	removeSqlite(path);
+	uint steps = 0;
+	uint64 flushes = 0, rows = 0;
+	double seconds = 0;
+	for (bool done = false; !done; ++steps) {
+		SqliteTablebase<2> bulk(0.2f, path);
+		bulk.setBulkWrites(true);
+		done = bulk.partialInit(100);
+		flushes += bulk.flushStats().flushes;
+		rows += bulk.flushStats().rows;
+		seconds += bulk.flushStats().seconds;
+	}
+	SqliteTablebase<2> bulk(0.2f, path);
+	uint mismatches = countMismatches(tablebase, bulk);
+	std::cout << "bulk written tablebase: " << steps << " reopenings, " << mismatches << " nodes differ, " << rows << " rows in "
+		<< flushes << " flushes at " << rows / std::max(seconds, 1e-9) << " rows/s" << std::endl;
+}
+
+// Plays batches of 2x2 games with the best moves of the exact tablebase, and compares how often the games through
+// each state were won with the state's score
+void compareEmpirical(const InMemoryTablebase<2>& tablebase, uint numBatches) {
+	EmpiricalTablebase<2> empirical;
+	GameBatch<2> games(10000, 0.2f);
+	std::vector<std::vector<GridState<2>>> states(games.size());
+	std::vector<std::pair<int, int>> moves(games.size());
+	for (uint batch = 0; batch < numBatches; ++batch) {
+		games.reset();
+		for (uint i = 0; i < games.size(); ++i) states[i].assign(1, games.getState(i));
+		while (games.numRunning() > 0) {
+			for (uint i = 0; i < games.size(); ++i) {
+				if (!games.isGameOver(i)) moves[i] = tablebase.bestMove(games.getState(i));
+			}
+			games.swipe(moves);
+			for (uint i = 0; i < games.size(); ++i) {
+				if (games.getState(i) != states[i].back()) states[i].push_back(games.getState(i));
+			}
+		}
+		for (uint i = 0; i < games.size(); ++i) {
+			empirical.addResult(states[i], games.getState(i).hasTile(2 * 2 + 1));
+		}
+	}
+	std::ostream discard(nullptr);
+	std::cout << "empirical tablebase, " << numBatches * games.size() << " games: ";
+	empirical.compare(tablebase, std::cout, discard);
+}
+
 int main() {
 	try {
 		signal(SIGINT, interruptHandler);
-		//InMemoryTablebase<2> tablebase(0.2f);
-		//tablebase.init();
-		//EmpiricalTablebase<2> eTablebase;	
+		InMemoryTablebase<2> exactTablebase(0.2f);
+		exactTablebase.init();
+		compareQuantized<uint16_t, InMemoryTablebase>(exactTablebase, "16-bit");
+		compareQuantized<uint8_t, InMemoryTablebase>(exactTablebase, "8-bit");
+		compareQuantized<uint16_t, RankedTablebase>(exactTablebase, "16-bit ranked");
+		compareQuantized<uint8_t, RankedTablebase>(exactTablebase, "8-bit ranked");
+		compareFile<MappedTablebase<2>>(exactTablebase, "test2x2.tb", "mapped tablebase");
+		compareFile<ArchiveTablebase<2>>(exactTablebase, "test2x2.tba", "archived tablebase");
+		compareWideArchive("test4x4.tba");
+		compareLazy(exactTablebase, 600);
+		compareResumed(exactTablebase, "test2x2.snapshot");
+		compareResumed(exactTablebase, "test2x2.snapshot", true);
+		compareResumedQuantized("test2x2.snapshot");
+		compareCounted(exactTablebase, "test2x2.sqlite");
+		compareCountedResumed(exactTablebase, "test2x2.sqlite", 100);
+		compareCountedResumed(exactTablebase, "test2x2.sqlite", 300);
+		compareCountedResumed(exactTablebase, "test2x2.sqlite", 1000);
+		compareBulk(exactTablebase, "test2x2bulk.sqlite");
+		compareLegacyLayout("test4x4legacy.sqlite");
+		InMemoryTablebase<2> canonicalTablebase(0.2f, true);
+		canonicalTablebase.init();
+		compareNodes(exactTablebase, canonicalTablebase, "canonical key tablebase");
+		EdgeFreeTablebase<2> edgeFreeTablebase(0.2f);
+		edgeFreeTablebase.init();
+		compareNodes(exactTablebase, edgeFreeTablebase, "edge free tablebase");
+		InMemoryTablebase<2> parallelTablebase(0.2f);
+		parallelTablebase.setNumThreads(std::max(std::thread::hardware_concurrency(), 2u));
+		parallelTablebase.init();
+		compareNodes(exactTablebase, parallelTablebase, "parallel generated tablebase");
+		EdgeFreeTablebase<2> parallelEdgeFreeTablebase(0.2f);
+		parallelEdgeFreeTablebase.setNumThreads(std::max(std::thread::hardware_concurrency(), 2u));
+		while (!parallelEdgeFreeTablebase.partialInit(300));
+		compareNodes(exactTablebase, parallelEdgeFreeTablebase, "parallel edge free tablebase");
+		std::filesystem::remove_all("test2x2.layers");
+		StreamingTablebase<2> streamingTablebase(0.2f, "test2x2.layers");
+		streamingTablebase.init();
+		compareNodes(exactTablebase, streamingTablebase, "streaming tablebase");
+		RankedTablebase<2> rankedTablebase(0.2f);
+		rankedTablebase.init();
+		compareNodes(exactTablebase, rankedTablebase, "ranked tablebase");
+		compareEmpirical(exactTablebase, 10);
 		SqliteTablebase<3> sTablebase(0.2f, "testdb.sqlite");
-		while(!s_interrupted && !sTablebase.partialInit(25000));
+		sTablebase.setNumThreads(std::thread::hardware_concurrency());
+		sTablebase.setBulkWrites(true);
+		while (!s_interrupted && !sTablebase.partialInit(25000)) {
+			const auto& stats = sTablebase.flushStats();
+			std::cout << stats.rows << " rows flushed at " << stats.rowsPerSecond() << " rows/s" << std::endl;
+		}
 		//bool same = (tablebase == sTablebase);
 		//std::cout << "same? " << same << std::endl;
 		//assert(same);
@@ -36,23 +350,6 @@ int main() {
 		//QueryResultsType<2> queryResults;
 		//sTablebase.recursiveQuery(testInitState, 0, 3, queryResults);
 		//printQueryResults(std::cout, queryResults);
-	
-		//for (int i = 0; i < 1000000; ++i) {
-		//	if (i % 1000000 == 0) {
-		//		std::cout << i << " iterations complete." << std::endl;
-		//	}
-		//	std::vector<GridState<2>> states;
-		//	Game<2> game(0.2f);
-		//	states.push_back(game.getState());
-		//	while (!game.isGameOver()) {
-		//		auto [dirRow, dirCol] = tablebase.bestMove(game.getState());
-		//		game.swipe(dirRow, dirCol);
-		//		states.push_back(game.getState());
-		//	}
-		//	eTablebase.addResult(states, game.getState().hasTile(2 * 2 + 1));
-		//}
-
-		//eTablebase.compare(tablebase, std::cout, std::cerr);
 	}
 	catch (const std::runtime_error& e) {
 		std::cerr << e.what() << std::endl;
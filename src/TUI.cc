@@ -1,4 +1,5 @@
 #include <curses.h>
+#include <filesystem>
 #include <fstream>
 #include <locale.h>
 #include <sstream>
@@ -6,8 +7,6 @@
 #include "Tablebase.h"
 #include "TemplateAdaptor.h"
 
-std::mt19937 s_random((std::random_device())());
-
 #if _MSC_VER
 #define IS_BACKSPACE(key) (key == 8)
 #else
@@ -39,8 +38,14 @@ int main() {
 	std::string resetBuffer = "";
 	uint gameSize = 4;
 	void* game = createGame(gameSize, 0.2);
-	InMemoryTablebase<2> tablebase(0.2f);
-	tablebase.init();
+	// the 2x2 tablebase is solved on the first launch and mapped from its file after that
+	const std::string tablebasePath = "tablebase2x2.tb";
+	if(!std::filesystem::exists(tablebasePath)) {
+		InMemoryTablebase<2> solved(0.2f);
+		solved.init();
+		MappedTablebase<2>::write(tablebasePath, solved);
+	}
+	MappedTablebase<2> tablebase(tablebasePath);
 
 	std::ofstream logFile("tui.log");
 
@@ -2,190 +2,353 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <compare>
+#include <cstring>
 #include <deque>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "ankerl/unordered_dense.h"
 #include "Common.h"
+#include "MappedFile.h"
 #include "Model.h"
+#include "Parallel.h"
+#include "Ranking.h"
+#include "Score.h"
+#include "SpillQueue.h"
 #include "sqlite3.h"
 
 template<uint N>
 using QueryResultsType = std::vector<std::tuple<int, GridState<N>, float>>;
 
+// Replaces children with every child of state and their edge weights, -1 for swipes. In canonical key mode children
+// are replaced by their canonical form, and children that share it are merged.
+template<uint N>
+void expandState(const GridState<N>& state, float fourChance, bool canonicalKeys, std::vector<std::pair<GridState<N>, float>>& children) {
+	children.clear();
+	auto addChild = [canonicalKeys, &children](const GridState<N>& child, float weight) {
+		GridState<N> key = canonicalKeys ? child.canonical().first : child;
+		for (auto& [existing, existingWeight] : children) {
+			if (existing == key) {
+				if (weight != -1) existingWeight += weight;
+				return;
+			}
+		}
+		children.emplace_back(key, weight);
+	};
+
+	// intermedate edges
+	uint emptyTiles = state.numEmptyTiles();
+	for (uint r = 0; r < N; ++r) {
+		for (uint c = 0; c < N; ++c) {
+			if (!state.isEmpty(r, c)) continue;
+
+			for (uint i = 0; i < 2; ++i) {
+				GridState<N> child = state;
+				child.writeTile(r, c, i + 1);
+				addChild(child, (i ? fourChance : (1.0f - fourChance)) / emptyTiles);
+			}
+		}
+	}
+
+	// non-intermediate edges
+	auto moves = state.allMoves();
+	for (uint i = 0; i < 4; ++i) {
+		if (moves.moved(i)) addChild(moves.children[i], -1);
+	}
+}
+
+// Runtime interface to a tablebase, for callers that pick the kind of tablebase at run time
 template<uint N>
 class ITablebase{
 public:
-	ITablebase(float fourChance) :
+	// An edge seen from one end, with the scores of the node at the other end, -1 for each score it does not have
+	struct Edge {
+		GridState<N> other;
+		// -1 for swipes
+		float weight;
+		std::pair<float, float> scores;
+	};
+	ITablebase(float fourChance, bool canonicalKeys = false) :
 		m_fourChance(fourChance),
+		m_canonicalKeys(canonicalKeys),
+		m_numThreads{ 1 },
+		m_dependencyCounting{ false } {}
+	virtual ~ITablebase() {}
+	virtual void init(uint64 maxActions = UINT64_MAX, int maxDepth = -1) = 0;
+	virtual bool partialInit(uint64 maxActions, int maxDepth = -1) = 0;
+	virtual float query(const GridState<N>& state) const = 0;
+	virtual void recursiveQuery(const GridState<N>& state, int currDepth, int maxDepth, QueryResultsType<N>& results) const = 0;
+	virtual std::pair<int, int> bestMove(const GridState<N>& state) const = 0;
+	// Number of threads generateEdges expands states on, and layered scoring scores nodes on. 1 keeps generation on
+	// the calling thread.
+	void setNumThreads(uint numThreads) { m_numThreads = std::max(numThreads, 1u); }
+	float fourChance() const { return m_fourChance; }
+	bool canonicalKeys() const { return m_canonicalKeys; }
+	// Makes calculateScores count the children each node still waits on and score every node once, instead of
+	// requeuing a node from every child that gets a score. The counts are kept in memory only, so a run in this mode
+	// has to finish scoring in the process that started it. Tablebases with their own calculateScores ignore it.
+	void setDependencyCounting(bool enabled) { m_dependencyCounting = enabled; }
+protected:
+	// The node a state is stored under, which is its canonical form in canonical key mode
+	GridState<N> toKey(const GridState<N>& state) const { return m_canonicalKeys ? state.canonical().first : state; }
+	// Replaces children with the keys of every child of state and their edge weights, -1 for swipes
+	void expand(const GridState<N>& state, std::vector<std::pair<GridState<N>, float>>& children) const;
+	uint numThreads() const { return m_numThreads; }
+	bool dependencyCounting() const { return m_dependencyCounting; }
+	const float m_fourChance;
+	// Store only one of the up to 8 rotations and reflections of every state
+	const bool m_canonicalKeys;
+private:
+	uint m_numThreads;
+	bool m_dependencyCounting;
+};
+
+// Generation and scoring of a tablebase, written once over the storage of BACKEND. BACKEND derives from
+// TablebaseCore<N, BACKEND>, befriends it, and provides these non-virtual members, which are called on the
+// BACKEND type so they can be inlined into the loops below:
+//   setNode, hasNode, getNodeScores, pushToEdgeQueue, popFromEdgeQueue, edgeQueueEmpty, addEdge, hasEdge,
+//   getChildEdges, getParentEdges, copyNodesToScoreQueue, pushToScoreQueue, popFromScoreQueue, scoreQueueEmpty,
+//   addInterScore, addNonInterScore
+// getChildEdges replaces its buffer with the edges from a node to each of its children, and getParentEdges with the
+// edges into a node from each of its parents. BACKEND may also hide initializeEdgeQueue, generateEdges or
+// calculateScores with its own, which can call the ones here. One whose calculateScores never calls the one here
+// also hides CORE_SCORING with false.
+template<uint N, class BACKEND>
+class TablebaseCore : public ITablebase<N> {
+public:
+	using Edge = typename ITablebase<N>::Edge;
+	TablebaseCore(float fourChance, bool canonicalKeys = false) :
+		ITablebase<N>(fourChance, canonicalKeys),
 		m_edgeQueueInitialized{ false },
 		m_scoreQueueInitialized{ false },
 		m_actionCount{ 0 },
 		m_totalActions{ 0 } {}
-	virtual ~ITablebase() {}
-	virtual void init(uint64 maxActions = UINT64_MAX, int maxDepth = -1);
-	virtual bool partialInit(uint64 maxActions, int maxDepth = -1);
-	virtual float query(const GridState<N>& state) const = 0;
-	virtual void recursiveQuery(const GridState<N>& state, int currDepth, int maxDepth, QueryResultsType<N>& results) const;
-	virtual std::pair<int, int> bestMove(const GridState<N>& state) const;
+	virtual void init(uint64 maxActions = UINT64_MAX, int maxDepth = -1) override;
+	virtual bool partialInit(uint64 maxActions, int maxDepth = -1) override;
+	virtual void recursiveQuery(const GridState<N>& state, int currDepth, int maxDepth, QueryResultsType<N>& results) const override;
+	virtual std::pair<int, int> bestMove(const GridState<N>& state) const override;
 protected:
-	virtual void initializeEdgeQueue();
-	virtual void generateEdges(uint64 maxActions, int maxDepth);
-	virtual void calculateScores(uint64 maxActions);
-	virtual void setNode(const GridState<N>& node, float noninterScore = -1, float interScore = -1) = 0;
-	virtual bool hasNode(const GridState<N>& node) const = 0;
-	virtual std::pair<float, float> getNodeScores(const GridState<N>& node) const = 0;
-	virtual void pushToEdgeQueue(const GridState<N>& node, int depth) = 0;
-	virtual std::pair<GridState<N>, int> popFromEdgeQueue() = 0;
-	virtual bool edgeQueueEmpty() = 0;
-	virtual void addEdge(const GridState<N>& parent, const GridState<N>& child, float weight) = 0;
-	virtual bool hasEdge(const GridState<N>& node) const = 0;
-	virtual std::vector<GridState<N>> getEdges(const GridState<N>& node) const = 0;
-	virtual float getEdgeWeight(const GridState<N>& parent, const GridState<N>& child) const = 0;
-	virtual std::vector<GridState<N>> getParents(const GridState<N>& child) const = 0;
-	virtual void copyNodesToScoreQueue() = 0;
-	virtual void pushToScoreQueue(const GridState<N>& node) = 0;
-	virtual GridState<N> popFromScoreQueue() = 0;
-	virtual bool scoreQueueEmpty() const = 0;
-	virtual void addInterScore(const GridState<N>& node, float score) = 0;
-	virtual void addNonInterScore(const GridState<N>& node, float score) = 0;
-	const float m_fourChance;
+	using ITablebase<N>::toKey;
+	using ITablebase<N>::expand;
+	using ITablebase<N>::numThreads;
+	using ITablebase<N>::m_canonicalKeys;
+	void initializeEdgeQueue();
+	void generateEdges(uint64 maxActions, int maxDepth);
+	void calculateScores(uint64 maxActions);
+	// states expanded together by parallel generation
+	static constexpr uint64 PARALLEL_BATCH_SIZE = 1 << 16;
+	// whether BACKEND scores through calculateScores here, and so through dependency counting when it is enabled
+	static constexpr bool CORE_SCORING = true;
 	bool m_edgeQueueInitialized;
 	bool m_scoreQueueInitialized;
 	uint64 m_actionCount;
 	uint64 m_totalActions;
+private:
+	BACKEND& backend() { return static_cast<BACKEND&>(*this); }
+	const BACKEND& backend() const { return static_cast<const BACKEND&>(*this); }
+	void generateEdgesParallel(uint64 maxActions, int maxDepth);
+	void queryChildren(const GridState<N>& node, std::pair<float, float> scores, int currDepth, int maxDepth, QueryResultsType<N>& results) const;
+	void calculateScoresCounted(uint64 maxActions);
+	// Counts the children of node whose score is not stored yet, and makes each score of node ready once it has no
+	// such children. Scores of node that are stored already are only looked up if storedScores is set.
+	void countChildren(const GridState<N>& node, bool storedScores);
+	// Counts the children of every node again from the stored scores, unless every node is scored
+	void recountScores();
+	// Scores one kind of score of a node whose children of the other kind are all scored, and counts it off the
+	// parents waiting on it
+	void resolveScore(const GridState<N>& node, bool finalScore);
+	bool scoringDone() const { return backend().scoreQueueEmpty() && m_readyScores.empty(); }
+	// bits of a batch position that hold the index of a child within its parent's children
+	static constexpr uint CHILD_INDEX_BITS = 8;
+	static_assert(2 * N * N + 4 < (1u << CHILD_INDEX_BITS), "too many children for a batch position");
+	// children of the state being expanded by generateEdges, with their edge weights
+	std::vector<std::pair<GridState<N>, float>> m_children;
+	// edges of the node calculateScores is scoring, and of its parents
+	std::vector<Edge> m_childEdges;
+	std::vector<Edge> m_parentEdges;
+	std::vector<std::pair<GridState<N>, int>> m_batch;
+	std::vector<std::vector<std::pair<GridState<N>, float>>> m_batchChildren;
+	// first position in the batch at which each child that may become a node appears
+	ConcurrentMap<GridState<N>> m_firstSeen;
+	// swipe children without an intermediate score and spawn children without a final score of every node
+	ankerl::unordered_dense::map<GridState<N>, std::pair<uint32, uint32> /*swipes, spawns*/> m_pendingChildren;
+	// nodes with one kind of score ready to be calculated, true for the final score
+	std::deque<std::pair<GridState<N>, bool>> m_readyScores;
+	// set once m_pendingChildren holds the counts of every node that has been popped from the score queue, which
+	// is only true in the process that filled the score queue
+	bool m_countsKept = false;
 };
 
 template<uint N>
-void ITablebase<N>::initializeEdgeQueue() {
+void ITablebase<N>::expand(const GridState<N>& state, std::vector<std::pair<GridState<N>, float>>& children) const {
+	expandState(state, m_fourChance, m_canonicalKeys, children);
+}
+
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::initializeEdgeQueue() {
 	m_edgeQueueInitialized = true;
-	setNode(GridState<N>());
-	pushToEdgeQueue(GridState<N>(), 0);
+	backend().setNode(GridState<N>());
+	backend().pushToEdgeQueue(GridState<N>(), 0);
 }
 
-template<uint N>
-void ITablebase<N>::init(uint64 maxActions, int maxDepth) {
-	initializeEdgeQueue();
-	generateEdges(maxActions, maxDepth);
-	copyNodesToScoreQueue();
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::init(uint64 maxActions, int maxDepth) {
+	backend().initializeEdgeQueue();
+	backend().generateEdges(maxActions, maxDepth);
+	backend().copyNodesToScoreQueue();
 	m_scoreQueueInitialized = true;
-	calculateScores(maxActions);
+	m_countsKept = true;
+	backend().calculateScores(maxActions);
 }
 
-template<uint N>
-bool ITablebase<N>::partialInit(uint64 maxActions, int maxDepth) {
+template<uint N, class BACKEND>
+bool TablebaseCore<N, BACKEND>::partialInit(uint64 maxActions, int maxDepth) {
 	if (!m_edgeQueueInitialized) {
-		initializeEdgeQueue();
+		backend().initializeEdgeQueue();
 	}
-	if (!edgeQueueEmpty()) {
-		generateEdges(maxActions, maxDepth);
+	if (!backend().edgeQueueEmpty()) {
+		backend().generateEdges(maxActions, maxDepth);
 		return false;
 	}
 	if (!m_scoreQueueInitialized) {
-		copyNodesToScoreQueue();
+		backend().copyNodesToScoreQueue();
 		m_scoreQueueInitialized = true;
+		m_countsKept = true;
 	}
-	if (!scoreQueueEmpty()) {
-		calculateScores(maxActions);
+	if constexpr (BACKEND::CORE_SCORING) {
+		if (this->dependencyCounting() && !m_countsKept) recountScores();
 	}
-	return scoreQueueEmpty();
+	if (!scoringDone()) {
+		backend().calculateScores(maxActions);
+	}
+	return scoringDone();
 }
 
-template<uint N>
-void ITablebase<N>::generateEdges(uint64 maxActions, int maxDepth) {
-	for (; m_actionCount < maxActions && !edgeQueueEmpty(); ++m_actionCount) {
-		auto [state, depth] = popFromEdgeQueue();
-
-		// intermedate edges
-		uint emptyTiles = state.numEmptyTiles();
-		for (uint r = 0; r < N; ++r) {
-			for (uint c = 0; c < N; ++c) {
-				if (!state.isEmpty(r, c)) continue;
-
-				for (uint i = 0; i < 2; ++i) {
-					GridState<N> child = state;
-					child.writeTile(r, c, i + 1);
-					addEdge(state, child, (i ? m_fourChance : (1.0f - m_fourChance)) / emptyTiles);
-					if ((maxDepth < 0 || depth < maxDepth) && !hasNode(child)) {
-						setNode(child);
-						pushToEdgeQueue(child, depth + 1);
-					}
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::generateEdges(uint64 maxActions, int maxDepth) {
+	if (numThreads() > 1) {
+		generateEdgesParallel(maxActions, maxDepth);
+	}
+	else {
+		for (; m_actionCount < maxActions && !backend().edgeQueueEmpty(); ++m_actionCount) {
+			auto [state, depth] = backend().popFromEdgeQueue();
+			expand(state, m_children);
+			for (const auto& [child, weight] : m_children) {
+				backend().addEdge(state, child, weight);
+				if ((maxDepth < 0 || depth < maxDepth) && !backend().hasNode(child)) {
+					backend().setNode(child);
+					backend().pushToEdgeQueue(child, depth + 1);
 				}
 			}
 		}
+	}
 
-		// non-intermediate edges
-		for (uint i = 0; i < 4; ++i) {
-			GridState<N> child = state;
-			switch (i) {
-			case 0: child.swipe(0, -1); break;
-			case 1: child.swipe(0, 1); break;
-			case 2: child.swipe(-1, 0); break;
-			case 3: child.swipe(1, 0); break;
-			}
+	m_totalActions += m_actionCount;
+	DEBUG_LOG("generateEdges exiting after " << m_actionCount << " actions (" << m_totalActions << " total)" << std::endl);
+	m_actionCount = 0;
+}
 
-			if (child == state) continue;
+// Pops the edge queue a batch at a time. The states of a batch are expanded on numThreads() threads, which also
+// record the first position in the batch of every child. The batch is then added in queue order on this thread,
+// checking hasNode only at those first positions, so the tablebase ends up exactly as after serial generation
+// and the edge queue is consistent between batches.
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::generateEdgesParallel(uint64 maxActions, int maxDepth) {
+	while (m_actionCount < maxActions && !backend().edgeQueueEmpty()) {
+		uint64 batchSize = std::min(maxActions - m_actionCount, PARALLEL_BATCH_SIZE);
+		m_batch.clear();
+		while (m_batch.size() < batchSize && !backend().edgeQueueEmpty()) m_batch.push_back(backend().popFromEdgeQueue());
+		if (m_batchChildren.size() < m_batch.size()) m_batchChildren.resize(m_batch.size());
+
+		parallelFor(numThreads(), m_batch.size(), [this](uint64 i) { expand(m_batch[i].first, m_batchChildren[i]); });
+		// the map keeps its size between batches and is only grown when a batch does not fit
+		for (bool full = true; full;) {
+			m_firstSeen.clear(numThreads());
+			std::atomic<bool> overflowed = false;
+			parallelFor(numThreads(), m_batch.size(), [this, maxDepth, &overflowed](uint64 i) {
+				if (maxDepth >= 0 && m_batch[i].second >= maxDepth) return;
+				const auto& children = m_batchChildren[i];
+				for (uint64 j = 0; j < children.size() && !overflowed; ++j) {
+					if (!m_firstSeen.insertMin(children[j].first, (i << CHILD_INDEX_BITS) | j)) overflowed = true;
+				}
+			});
+			full = overflowed;
+			if (full) m_firstSeen.grow(numThreads());
+		}
 
-			addEdge(state, child, -1);
-			if ((maxDepth < 0 || depth < maxDepth) && !hasNode(child)) {
-				setNode(child);
-				pushToEdgeQueue(child, depth + 1);
+		for (uint64 i = 0; i < m_batch.size(); ++i) {
+			const auto& [state, depth] = m_batch[i];
+			const auto& children = m_batchChildren[i];
+			for (uint64 j = 0; j < children.size(); ++j) {
+				const auto& [child, weight] = children[j];
+				backend().addEdge(state, child, weight);
+				if ((maxDepth < 0 || depth < maxDepth) && m_firstSeen.find(child)->load(std::memory_order_relaxed) == ((i << CHILD_INDEX_BITS) | j) && !backend().hasNode(child)) {
+					backend().setNode(child);
+					backend().pushToEdgeQueue(child, depth + 1);
+				}
 			}
 		}
+		m_actionCount += m_batch.size();
 	}
-
-	m_totalActions += m_actionCount;
-	DEBUG_LOG("generateEdges exiting after " << m_actionCount << " actions (" << m_totalActions << " total)" << std::endl);
-	m_actionCount = 0;
 }
 
-template<uint N>
-void ITablebase<N>::calculateScores(uint64 maxActions) {
-	for (; m_actionCount < maxActions && !scoreQueueEmpty(); ++m_actionCount) {
-		GridState<N> state = popFromScoreQueue();
-		auto [scoreFinal, scoreInter] = getNodeScores(state);
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::calculateScores(uint64 maxActions) {
+	if (this->dependencyCounting()) {
+		calculateScoresCounted(maxActions);
+		return;
+	}
+	for (; m_actionCount < maxActions && !backend().scoreQueueEmpty(); ++m_actionCount) {
+		GridState<N> state = backend().popFromScoreQueue();
+		auto [scoreFinal, scoreInter] = backend().getNodeScores(state);
 		if (scoreFinal != -1.0f && scoreInter != -1.0f) continue;
 
 		bool foundScore = false;
 		// Meets the win condition of having the max tile
 		// In the future this should be updated to handle alternate win conditions
 		if (state.hasTile(N * N + 1)) {
-			setNode(state, 1.0f, 1.0f);
+			backend().setNode(state, 1.0f, 1.0f);
 			foundScore = true;
 		}
 		// Lost State
 		else if (!state.hasMoves() && state != GridState<N>()) {
-			setNode(state, 0.0f, 0.0f);
+			backend().setNode(state, 0.0f, 0.0f);
 			foundScore = true;
 		}
 		// Assume any non-final edge node has a score of 0.5
 		// In the future this will use an analysis algorithm to make a better guess
-		else if (!hasEdge(state)) {
+		else if (!backend().hasEdge(state)) {
 			DEBUG_LOG("I thought me were generating to infinite depth....");
 			DEBUG_ASSERT(0);
-			setNode(state, 0.5f, 0.5f);
+			backend().setNode(state, 0.5f, 0.5f);
 			foundScore = true;
 		}
 		else {
+			backend().getChildEdges(state, m_childEdges);
 			if (scoreFinal == -1.0f) {
 				// check if all the dependent intermediate scores have been calculated
 				bool readyToCalculate = true;
 				float score = 0.0f;
-				for (const GridState<N>& childState : getEdges(state)) {
-					float edgeWeight = getEdgeWeight(state, childState);
-					if (edgeWeight == -1) {
-						if (getNodeScores(childState).second == -1) {
+				for (const Edge& edge : m_childEdges) {
+					if (edge.weight == -1) {
+						if (edge.scores.second == -1) {
 							readyToCalculate = false;
 							break;
 						}
-						score = std::max(score, getNodeScores(childState).second);
+						score = std::max(score, edge.scores.second);
 					}
 				}
 				if (readyToCalculate) {
-					addNonInterScore(state, score);
+					backend().addNonInterScore(state, score);
 					foundScore = true;
 				}
 			}
@@ -193,289 +356,2152 @@ void ITablebase<N>::calculateScores(uint64 maxActions) {
 				// check if all the dependent intermediate scores have been calculated
 				bool readyToCalculate = true;
 				float score = 0.0f;
-				for (const GridState<N>& childState : getEdges(state)) {
-					float edgeWeight = getEdgeWeight(state, childState);
-					if (edgeWeight != -1) {
-						if (getNodeScores(childState).first == -1) {
+				for (const Edge& edge : m_childEdges) {
+					if (edge.weight != -1) {
+						if (edge.scores.first == -1) {
 							readyToCalculate = false;
 							break;
 						}
-						score += edgeWeight * getNodeScores(childState).first;
+						score += edge.weight * edge.scores.first;
+					}
+				}
+				if (readyToCalculate) {
+					backend().addInterScore(state, score);
+					foundScore = true;
+				}
+			}
+		}
+		if (foundScore) {
+			backend().getParentEdges(state, m_parentEdges);
+			for (const Edge& edge : m_parentEdges) {
+				if (edge.scores.first == -1.0f || edge.scores.second == -1.0f) {
+					backend().pushToScoreQueue(edge.other);
+				}
+			}
+		}
+	}
+	m_totalActions += m_actionCount;
+	DEBUG_LOG("calculateScores exiting after " << m_actionCount << " actions (" << m_totalActions << " total)" << std::endl);
+	m_actionCount = 0;
+}
+
+// The score queue, which copyNodesToScoreQueue fills with every node, is emptied first to count the children of
+// every node. Only then are scores calculated, since a child's score has to be counted off parents that have all
+// been counted. Every node enters m_readyScores once for each kind of score, so each score is calculated once and
+// each edge is looked at a constant number of times.
+// The counts are only kept in memory, so a process that continues scoring that another one started counts again.
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::calculateScoresCounted(uint64 maxActions) {
+	if (!m_countsKept) recountScores();
+	for (; m_actionCount < maxActions && !backend().scoreQueueEmpty(); ++m_actionCount) {
+		countChildren(backend().popFromScoreQueue(), false);
+	}
+	for (; m_actionCount < maxActions && backend().scoreQueueEmpty() && !m_readyScores.empty(); ++m_actionCount) {
+		auto [state, finalScore] = m_readyScores.front();
+		m_readyScores.pop_front();
+		resolveScore(state, finalScore);
+	}
+	if (scoringDone()) m_pendingChildren.clear();
+	m_totalActions += m_actionCount;
+	DEBUG_LOG("calculateScoresCounted exiting after " << m_actionCount << " actions (" << m_totalActions << " total)" << std::endl);
+	m_actionCount = 0;
+}
+
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::countChildren(const GridState<N>& node, bool storedScores) {
+	uint32 swipes = 0;
+	uint32 spawns = 0;
+	bool terminal = node.hasTile(N * N + 1) || (!node.hasMoves() && node != GridState<N>()) || !backend().hasEdge(node);
+	if (!terminal) {
+		backend().getChildEdges(node, m_childEdges);
+		for (const Edge& edge : m_childEdges) {
+			if (edge.weight == -1 && edge.scores.second == -1) ++swipes;
+			else if (edge.weight != -1 && edge.scores.first == -1) ++spawns;
+		}
+	}
+	auto scores = storedScores ? backend().getNodeScores(node) : std::make_pair(-1.0f, -1.0f);
+	m_pendingChildren[node] = std::make_pair(swipes, spawns);
+	if (swipes == 0 && scores.first == -1) m_readyScores.emplace_back(node, true);
+	if (spawns == 0 && scores.second == -1) m_readyScores.emplace_back(node, false);
+}
+
+// Every score depends on the scores of all the node's descendants, so the intermediate score of the root, which
+// spawns the first tiles, is only stored once every node is scored.
+// The whole count is done at once and not counted as actions, since a later process would have to start it over.
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::recountScores() {
+	m_countsKept = true;
+	m_pendingChildren.clear();
+	m_readyScores.clear();
+	if (backend().getNodeScores(GridState<N>()).second != -1) return;
+	while (!backend().scoreQueueEmpty()) backend().popFromScoreQueue();
+	backend().copyNodesToScoreQueue();
+	while (!backend().scoreQueueEmpty()) countChildren(backend().popFromScoreQueue(), true);
+}
+
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::resolveScore(const GridState<N>& node, bool finalScore) {
+	float score = 0.0f;
+	if (node.hasTile(N * N + 1)) {
+		score = 1.0f;
+	}
+	else if (!node.hasMoves() && node != GridState<N>()) {
+		score = 0.0f;
+	}
+	else if (!backend().hasEdge(node)) {
+		DEBUG_LOG("I thought me were generating to infinite depth....");
+		DEBUG_ASSERT(0);
+		score = 0.5f;
+	}
+	else {
+		backend().getChildEdges(node, m_childEdges);
+		for (const Edge& edge : m_childEdges) {
+			if (finalScore && edge.weight == -1) score = std::max(score, edge.scores.second);
+			else if (!finalScore && edge.weight != -1) score += edge.weight * edge.scores.first;
+		}
+	}
+	if (finalScore) backend().addNonInterScore(node, score);
+	else backend().addInterScore(node, score);
+
+	// a final score completes the intermediate score of a parent that spawned the node, and an intermediate score
+	// the final score of a parent that swiped into it
+	backend().getParentEdges(node, m_parentEdges);
+	for (const Edge& edge : m_parentEdges) {
+		if ((edge.weight == -1) == finalScore) continue;
+		auto pendingChildren = m_pendingChildren.find(edge.other);
+		if (pendingChildren == m_pendingChildren.end()) throw std::logic_error("scored a child of a node whose children were not counted");
+		auto& [swipes, spawns] = pendingChildren->second;
+		uint32& pending = finalScore ? spawns : swipes;
+		if (pending > 0 && --pending == 0) m_readyScores.emplace_back(edge.other, !finalScore);
+	}
+}
+
+template<uint N, class BACKEND>
+std::pair<int, int> TablebaseCore<N, BACKEND>::bestMove(const GridState<N>& state) const {
+	// moves are picked on the stored node and mapped back to the orientation of state
+	auto [node, symmetry] = m_canonicalKeys ? state.canonical() : std::make_pair(state, 0u);
+	thread_local std::vector<Edge> edges;
+	backend().getChildEdges(node, edges);
+	if (edges.empty()) return std::make_pair(-1, -1);
+	float bestScore = 0;
+	int bestDirection = -1;
+	// find best intermediate child score
+	auto moves = node.allMoves();
+	for (uint i = 0; i < 4; ++i) {
+		if (!moves.moved(i)) continue;
+		GridState<N> child = toKey(moves.children[i]);
+		auto edge = std::find_if(edges.begin(), edges.end(), [&child](const Edge& e) { return e.weight == -1 && e.other == child; });
+		float score = edge == edges.end() ? -1.0f : edge->scores.second;
+		if (score > bestScore) {
+			bestScore = score;
+			bestDirection = i;
+		}
+	}
+	return bestDirection < 0 ? std::make_pair(-1, -1) : GridState<N>::untransformMove(MOVE_DIRECTIONS[bestDirection], symmetry);
+}
+
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::recursiveQuery(const GridState<N>& state, int currDepth, int maxDepth, QueryResultsType<N>& results) const {
+	if (currDepth > maxDepth) return;
+	GridState<N> node = toKey(state);
+	queryChildren(node, backend().getNodeScores(node), currDepth, maxDepth, results);
+}
+
+// Every level of the recursion has its own edge buffer, which later queries on the thread reuse
+template<uint N, class BACKEND>
+void TablebaseCore<N, BACKEND>::queryChildren(const GridState<N>& node, std::pair<float, float> scores, int currDepth, int maxDepth, QueryResultsType<N>& results) const {
+	bool intermediate = currDepth & 1;
+	results.emplace_back(std::make_tuple(currDepth, node, intermediate ? scores.second : scores.first));
+	if (currDepth == maxDepth) return;
+	thread_local std::deque<std::vector<Edge>> levelEdges;
+	if (levelEdges.size() <= uint(currDepth)) levelEdges.resize(currDepth + 1);
+	std::vector<Edge>& edges = levelEdges[currDepth];
+	backend().getChildEdges(node, edges);
+	for (const Edge& edge : edges) {
+		if ((!intermediate && edge.weight != -1.0f) || (intermediate && edge.weight == -1.0f)) continue;
+		queryChildren(edge.other, edge.scores, currDepth + 1, maxDepth, results);
+	}
+}
+
+// Edges are stored in compressed sparse row form over dense node ids, the id of a state being its index in
+// m_states. generateEdges expands nodes in id order, so each node's children are appended as one contiguous
+// range of m_edgeTargets. The reverse adjacency is built once generation is complete.
+// Scores are calculated a tile sum layer at a time instead of through a score queue. A swipe keeps the tile sum
+// and a spawn raises it, so once every higher layer is scored each node of a layer is scored exactly once.
+// Scores are kept as SCORE_T through ScoreCodec. With a fixed point type, the layers the current layer spawns into are
+// also kept in full precision while it is scored, so every score is rounded once and is off by at most MAX_ERROR.
+template<uint N, class SCORE_T = float>
+class InMemoryTablebase : public TablebaseCore<N, InMemoryTablebase<N, SCORE_T>> {
+	using Core = TablebaseCore<N, InMemoryTablebase<N, SCORE_T>>;
+	friend Core;
+	static constexpr bool CORE_SCORING = false;
+public:
+	InMemoryTablebase(float fourChance, bool canonicalKeys = false) : Core(fourChance, canonicalKeys) {}
+	virtual void init(uint64 maxActions = UINT64_MAX, int maxDepth = -1) override;
+	virtual float query(const GridState<N>& state) const override;
+	void dump(std::ostream &o) const;
+	// Calls f(node, final score, intermediate score) for every node
+	template<class F>
+	void forEachNode(F&& f) const;
+	// Writes everything partialInit needs to continue, replacing path only once the snapshot is complete
+	void saveSnapshot(const std::string& path) const;
+	// Replaces this tablebase with a snapshot written by a build of the same code with the same settings
+	void loadSnapshot(const std::string& path);
+protected:
+	void calculateScores(uint64 maxActions);
+	void setNode(const GridState<N>& node, float noninterScore = -1, float interScore = -1);
+	bool hasNode(const GridState<N>& node) const;
+	std::pair<float, float> getNodeScores(const GridState<N>& node) const;
+	void pushToEdgeQueue(const GridState<N>& node, int depth);
+	std::pair<GridState<N>, int> popFromEdgeQueue();
+	bool edgeQueueEmpty();
+	void addEdge(const GridState<N>& parent, const GridState<N>& child, float weight);
+	bool hasEdge(const GridState<N>& node) const;
+	void getChildEdges(const GridState<N>& node, std::vector<typename Core::Edge>& edges) const;
+	void getParentEdges(const GridState<N>& child, std::vector<typename Core::Edge>& edges) const;
+	void copyNodesToScoreQueue();
+	void pushToScoreQueue(const GridState<N>& node);
+	GridState<N> popFromScoreQueue();
+	bool scoreQueueEmpty() const;
+	void addInterScore(const GridState<N>&node, float score);
+	void addNonInterScore(const GridState<N>& node, float score);
+private:
+	// Returns the id of a stored state, throws std::out_of_range if there is none
+	uint32 findId(const GridState<N>& state) const;
+	// Returns the id of state, storing it first if needed
+	uint32 intern(const GridState<N>& state);
+	const GridState<N>& stateOf(uint32 id) const { return m_states.values()[id]; }
+	using Codec = ScoreCodec<SCORE_T>;
+	std::pair<float, float> scoresOf(uint32 id) const { return std::make_pair(Codec::decode(m_scores[id].first), Codec::decode(m_scores[id].second)); }
+	std::pair<float, float> scoresOrUnknown(uint32 id) const { return m_isNode[id] ? scoresOf(id) : std::make_pair(-1.0f, -1.0f); }
+	void storeScores(uint32 id, float finalScore, float interScore) { m_scores[id] = std::make_pair(Codec::encode(finalScore), Codec::encode(interScore)); }
+	static constexpr bool ROUNDS = !std::is_floating_point_v<SCORE_T>;
+	// Full precision scores of a node whose layer is in m_window, else its stored scores
+	std::pair<float, float> exactScoresOf(uint32 id) const;
+	// Stores the scores of a node of the layer being scored, keeping them in m_window as well
+	void storeExactScores(uint32 id, float finalScore, float interScore);
+	// Points the window slot of a layer at it before it is scored
+	void openWindowLayer(size_t layer);
+	uint64 edgesBegin(uint32 id) const { return id < m_edgeOffsets.size() ? m_edgeOffsets[id] : m_edgeTargets.size(); }
+	uint64 edgesEnd(uint32 id) const { return id + 1 < m_edgeOffsets.size() ? m_edgeOffsets[id + 1] : m_edgeTargets.size(); }
+	void buildReverseEdges();
+	void buildLayers();
+	// Scores terminal nodes, and the intermediate score of the others from the final scores of their spawns
+	void scoreIntermediate(uint32 id);
+	// Final score of a node from the intermediate scores of its swipes, which are in the same layer
+	void scoreFinal(uint32 id);
+	struct SnapshotHeader {
+		char magic[8];
+		uint32 version;
+		uint32 n;
+		uint32 stateBytes;
+		uint32 scoreBytes;
+		float fourChance;
+		uint32 canonicalKeys;
+		uint32 edgeQueueInitialized;
+		uint32 scoreQueueInitialized;
+		uint64 totalActions;
+		uint64 nextLayer;
+	};
+	static constexpr char SNAPSHOT_MAGIC[8] = { '2', '0', '4', '8', 'T', 'B', 'S', 'N' };
+	static constexpr uint32 SNAPSHOT_VERSION = 2;
+	static_assert(std::is_trivially_copyable_v<GridState<N>>, "snapshots copy states as raw bytes");
+	// Arrays are stored as their length followed by their elements' bytes
+	template<class T>
+	static void writeArray(std::ostream& o, const std::vector<T>& array);
+	template<class T>
+	static std::vector<T> readArray(std::istream& i);
+	// every state that is a node or the child of an edge, which is not a node when cut off by maxDepth
+	ankerl::unordered_dense::set<GridState<N>> m_states;
+	std::vector<bool> m_isNode;
+	std::vector<std::pair<SCORE_T, SCORE_T> /*final_score, intermediate_score*/> m_scores;
+	// edges of node i are [m_edgeOffsets[i], m_edgeOffsets[i + 1]), nodes past the end have none after the last
+	std::vector<uint64> m_edgeOffsets;
+	std::vector<uint32> m_edgeTargets;
+	std::vector<float> m_edgeWeights;
+	// parents of node i are m_parentSources[m_parentOffsets[i]] up to m_parentOffsets[i + 1]
+	std::vector<uint64> m_parentOffsets;
+	std::vector<uint32> m_parentSources;
+	std::deque<std::pair<GridState<N>, int>> m_edgeQueue;
+	// node ids by descending tile sum, layer i being m_layerNodes[m_layerOffsets[i]] up to m_layerOffsets[i + 1]
+	std::vector<uint32> m_layerNodes;
+	std::vector<uint64> m_layerOffsets;
+	// first layer calculateScores has not scored yet
+	size_t m_nextLayer = 0;
+	struct WindowLayer {
+		uint64 halfSum = UINT64_MAX;
+		// offset of the layer in m_layerNodes, its scores being in the same order
+		uint64 begin = 0;
+		std::vector<std::pair<float, float>> scores;
+	};
+	// layer being scored and the two above it, which hold its spawns, by half tile sum modulo 3. Only kept if ROUNDS.
+	std::array<WindowLayer, 3> m_window;
+};
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::init(uint64 maxActions, int maxDepth) {
+	Core::init(maxActions, maxDepth);
+	DEBUG_LOG("node count: " << m_states.size() << " edge count: " << m_edgeTargets.size() << std::endl);
+}
+
+template<uint N, class SCORE_T>
+float InMemoryTablebase<N, SCORE_T>::query(const GridState<N>& state) const {
+	auto it = m_states.find(this->toKey(state));
+	if (it == m_states.end()) return -1.0f;
+	uint32 id = uint32(it - m_states.begin());
+	return m_isNode[id] ? Codec::decode(m_scores[id].first) : -1.0f;
+}
+
+template<uint N, class SCORE_T>
+uint32 InMemoryTablebase<N, SCORE_T>::findId(const GridState<N>& state) const {
+	auto it = m_states.find(state);
+	if (it == m_states.end()) throw std::out_of_range("state is not in the tablebase");
+	return uint32(it - m_states.begin());
+}
+
+template<uint N, class SCORE_T>
+uint32 InMemoryTablebase<N, SCORE_T>::intern(const GridState<N>& state) {
+	auto [it, inserted] = m_states.insert(state);
+	uint32 id = uint32(it - m_states.begin());
+	if (inserted) {
+		if (m_states.size() > UINT32_MAX) throw std::runtime_error("too many states for 32 bit node ids");
+		m_isNode.push_back(false);
+		m_scores.emplace_back(Codec::encode(-1.0f), Codec::encode(-1.0f));
+	}
+	return id;
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::setNode(const GridState<N>& node, float noninterScore, float interScore) {
+	uint32 id = intern(node);
+	m_isNode[id] = true;
+	storeScores(id, noninterScore, interScore);
+}
+
+template<uint N, class SCORE_T>
+bool InMemoryTablebase<N, SCORE_T>::hasNode(const GridState<N>& node) const {
+	auto it = m_states.find(node);
+	return it != m_states.end() && m_isNode[it - m_states.begin()];
+}
+
+template<uint N, class SCORE_T>
+std::pair<float, float> InMemoryTablebase<N, SCORE_T>::getNodeScores(const GridState<N>& node) const {
+	uint32 id = findId(node);
+	if (!m_isNode[id]) throw std::out_of_range("state is not in the tablebase");
+	return scoresOf(id);
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::pushToEdgeQueue(const GridState<N>& node, int depth) {
+	m_edgeQueue.push_back(std::make_pair(node, depth));
+}
+
+template<uint N, class SCORE_T>
+std::pair<GridState<N>, int> InMemoryTablebase<N, SCORE_T>::popFromEdgeQueue() {
+	std::pair<GridState<N>, int> firstElement = m_edgeQueue.front();
+	m_edgeQueue.pop_front();
+	return firstElement;
+}
+
+template<uint N, class SCORE_T>
+bool InMemoryTablebase<N, SCORE_T>::edgeQueueEmpty() {
+	return m_edgeQueue.empty();
+}
+
+// Parents must be added in id order, with all the edges of a parent added in a row
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::addEdge(const GridState<N>& parent, const GridState<N>& child, float weight) {
+	uint32 parentId = findId(parent);
+	uint32 childId = intern(child);
+	if (parentId + 1 < m_edgeOffsets.size()) throw std::logic_error("edges must be added in parent id order");
+	while (m_edgeOffsets.size() <= parentId) m_edgeOffsets.push_back(m_edgeTargets.size());
+	m_edgeTargets.push_back(childId);
+	m_edgeWeights.push_back(weight);
+}
+
+template<uint N, class SCORE_T>
+bool InMemoryTablebase<N, SCORE_T>::hasEdge(const GridState<N>& node) const {
+	auto it = m_states.find(node);
+	if (it == m_states.end()) return false;
+	uint32 id = uint32(it - m_states.begin());
+	return edgesBegin(id) != edgesEnd(id);
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::getChildEdges(const GridState<N>& node, std::vector<typename Core::Edge>& edges) const {
+	edges.clear();
+	auto it = m_states.find(node);
+	if (it == m_states.end()) return;
+	uint32 id = uint32(it - m_states.begin());
+	for (uint64 e = edgesBegin(id); e < edgesEnd(id); ++e) {
+		uint32 childId = m_edgeTargets[e];
+		edges.push_back({ stateOf(childId), m_edgeWeights[e], scoresOrUnknown(childId) });
+	}
+}
+
+// The weight of each edge is found in the parent's edge list, which holds at most a few dozen edges
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::getParentEdges(const GridState<N>& child, std::vector<typename Core::Edge>& edges) const {
+	edges.clear();
+	auto it = m_states.find(child);
+	if (it == m_states.end() || m_parentOffsets.empty()) return;
+	uint32 id = uint32(it - m_states.begin());
+	for (uint64 p = m_parentOffsets[id]; p < m_parentOffsets[id + 1]; ++p) {
+		uint32 parentId = m_parentSources[p];
+		uint64 e = edgesBegin(parentId);
+		while (m_edgeTargets[e] != id) ++e;
+		edges.push_back({ stateOf(parentId), m_edgeWeights[e], scoresOrUnknown(parentId) });
+	}
+}
+
+// Counting sort of the forward edges by child
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::buildReverseEdges() {
+	uint32 numStates = uint32(m_states.size());
+	m_edgeOffsets.resize(numStates + 1, m_edgeTargets.size());
+	m_edgeOffsets.shrink_to_fit();
+	m_edgeTargets.shrink_to_fit();
+	m_edgeWeights.shrink_to_fit();
+
+	m_parentOffsets.assign(numStates + 1, 0);
+	for (uint32 child : m_edgeTargets) ++m_parentOffsets[child + 1];
+	for (uint32 i = 0; i < numStates; ++i) m_parentOffsets[i + 1] += m_parentOffsets[i];
+	m_parentSources.resize(m_edgeTargets.size());
+	std::vector<uint64> next(m_parentOffsets.begin(), m_parentOffsets.end() - 1);
+	for (uint32 parent = 0; parent < numStates; ++parent) {
+		for (uint64 e = m_edgeOffsets[parent]; e < m_edgeOffsets[parent + 1]; ++e) {
+			m_parentSources[next[m_edgeTargets[e]]++] = parent;
+		}
+	}
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::buildLayers() {
+	std::vector<uint64> tileSums(m_states.size());
+	parallelFor(this->numThreads(), m_states.size(), [this, &tileSums](uint64 id) { tileSums[id] = stateOf(uint32(id)).tileSum(); });
+	m_layerNodes.clear();
+	for (uint32 id = 0; id < m_states.size(); ++id) {
+		if (m_isNode[id]) m_layerNodes.push_back(id);
+	}
+	std::sort(m_layerNodes.begin(), m_layerNodes.end(), [&tileSums](uint32 a, uint32 b) {
+		return tileSums[a] != tileSums[b] ? tileSums[a] > tileSums[b] : a < b;
+	});
+	m_layerOffsets.clear();
+	for (uint64 i = 0; i < m_layerNodes.size(); ++i) {
+		if (i == 0 || tileSums[m_layerNodes[i]] != tileSums[m_layerNodes[i - 1]]) m_layerOffsets.push_back(i);
+	}
+	m_layerOffsets.push_back(m_layerNodes.size());
+	m_nextLayer = 0;
+}
+
+// Generation is complete once this is called, so the edges are frozen here
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::copyNodesToScoreQueue() {
+	buildReverseEdges();
+	buildLayers();
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::pushToScoreQueue(const GridState<N>&) {
+	throw std::logic_error("InMemoryTablebase scores by layer and has no score queue");
+}
+
+template<uint N, class SCORE_T>
+GridState<N> InMemoryTablebase<N, SCORE_T>::popFromScoreQueue() {
+	throw std::logic_error("InMemoryTablebase scores by layer and has no score queue");
+}
+
+// True once every layer is scored
+template<uint N, class SCORE_T>
+bool InMemoryTablebase<N, SCORE_T>::scoreQueueEmpty() const {
+	return m_nextLayer + 1 >= m_layerOffsets.size();
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::addInterScore(const GridState<N>& node, float score) {
+	m_scores[findId(node)].second = Codec::encode(score);
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::addNonInterScore(const GridState<N>& node, float score) {
+	m_scores[findId(node)].first = Codec::encode(score);
+}
+
+// Scores one layer per step, highest tile sum first. Every node of a layer counts as one action, and the layer
+// in progress is always finished.
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::calculateScores(uint64 maxActions) {
+	for (; this->m_actionCount < maxActions && !scoreQueueEmpty(); ++m_nextLayer) {
+		const uint32* layer = m_layerNodes.data() + m_layerOffsets[m_nextLayer];
+		uint64 layerSize = m_layerOffsets[m_nextLayer + 1] - m_layerOffsets[m_nextLayer];
+		if constexpr (ROUNDS) openWindowLayer(m_nextLayer);
+		parallelFor(this->numThreads(), layerSize, [this, layer](uint64 i) { scoreIntermediate(layer[i]); });
+		parallelFor(this->numThreads(), layerSize, [this, layer](uint64 i) { scoreFinal(layer[i]); });
+		this->m_actionCount += layerSize;
+	}
+	if (scoreQueueEmpty()) m_window = {};
+	this->m_totalActions += this->m_actionCount;
+	DEBUG_LOG("calculateScores exiting after " << this->m_actionCount << " actions (" << this->m_totalActions << " total)" << std::endl);
+	this->m_actionCount = 0;
+}
+
+// A node's layer is found from its tile sum and the node within it by id, as ids ascend within a layer
+template<uint N, class SCORE_T>
+std::pair<float, float> InMemoryTablebase<N, SCORE_T>::exactScoresOf(uint32 id) const {
+	if constexpr (ROUNDS) {
+		uint64 halfSum = stateOf(id).tileSum() / 2;
+		const WindowLayer& window = m_window[halfSum % 3];
+		if (window.halfSum == halfSum) {
+			auto begin = m_layerNodes.begin() + window.begin;
+			auto it = std::lower_bound(begin, begin + window.scores.size(), id);
+			if (it != begin + window.scores.size() && *it == id) return window.scores[it - begin];
+		}
+	}
+	// children cut off by maxDepth are in no layer
+	return scoresOf(id);
+}
+
+// Only the layer being scored is stored to, and each node only by the thread scoring it
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::storeExactScores(uint32 id, float finalScore, float interScore) {
+	storeScores(id, finalScore, interScore);
+	if constexpr (ROUNDS) {
+		WindowLayer& window = m_window[stateOf(id).tileSum() / 2 % 3];
+		auto begin = m_layerNodes.begin() + window.begin;
+		window.scores[std::lower_bound(begin, begin + window.scores.size(), id) - begin] = std::make_pair(finalScore, interScore);
+	}
+}
+
+// Replaces the layer three half tile sums up, which no layer from here down spawns into
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::openWindowLayer(size_t layer) {
+	uint64 begin = m_layerOffsets[layer];
+	uint64 layerSize = m_layerOffsets[layer + 1] - begin;
+	uint64 halfSum = stateOf(m_layerNodes[begin]).tileSum() / 2;
+	WindowLayer& window = m_window[halfSum % 3];
+	window.halfSum = halfSum;
+	window.begin = begin;
+	window.scores.resize(layerSize);
+	for (uint64 i = 0; i < layerSize; ++i) window.scores[i] = scoresOf(m_layerNodes[begin + i]);
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::scoreIntermediate(uint32 id) {
+	auto [scoreFinal, scoreInter] = exactScoresOf(id);
+	if (scoreFinal != -1.0f && scoreInter != -1.0f) return;
+
+	const GridState<N>& state = stateOf(id);
+	if (state.hasTile(N * N + 1)) {
+		storeExactScores(id, 1.0f, 1.0f);
+	}
+	else if (!state.hasMoves() && state != GridState<N>()) {
+		storeExactScores(id, 0.0f, 0.0f);
+	}
+	else if (edgesBegin(id) == edgesEnd(id)) {
+		DEBUG_LOG("I thought me were generating to infinite depth....");
+		DEBUG_ASSERT(0);
+		storeExactScores(id, 0.5f, 0.5f);
+	}
+	else if (scoreInter == -1.0f) {
+		float score = 0.0f;
+		for (uint64 e = edgesBegin(id); e < edgesEnd(id); ++e) {
+			if (m_edgeWeights[e] == -1) continue;
+			float childScore = exactScoresOf(m_edgeTargets[e]).first;
+			// a child cut off by maxDepth is never scored
+			if (childScore == -1) return;
+			score += m_edgeWeights[e] * childScore;
+		}
+		storeExactScores(id, scoreFinal, score);
+	}
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::scoreFinal(uint32 id) {
+	auto [scoreFinal, scoreInter] = exactScoresOf(id);
+	if (scoreFinal != -1.0f || edgesBegin(id) == edgesEnd(id)) return;
+	float score = 0.0f;
+	for (uint64 e = edgesBegin(id); e < edgesEnd(id); ++e) {
+		if (m_edgeWeights[e] != -1) continue;
+		float childScore = exactScoresOf(m_edgeTargets[e]).second;
+		if (childScore == -1) return;
+		score = std::max(score, childScore);
+	}
+	storeExactScores(id, score, scoreInter);
+}
+
+template<uint N, class SCORE_T>
+template<class F>
+void InMemoryTablebase<N, SCORE_T>::forEachNode(F&& f) const {
+	for (uint32 id = 0; id < m_states.size(); ++id) {
+		if (!m_isNode[id]) continue;
+		auto [scoreFinal, scoreInter] = scoresOf(id);
+		f(stateOf(id), scoreFinal, scoreInter);
+	}
+}
+
+template<uint N, class SCORE_T>
+template<class T>
+void InMemoryTablebase<N, SCORE_T>::writeArray(std::ostream& o, const std::vector<T>& array) {
+	uint64 size = array.size();
+	o.write(reinterpret_cast<const char*>(&size), sizeof(size));
+	o.write(reinterpret_cast<const char*>(array.data()), size * sizeof(T));
+}
+
+template<uint N, class SCORE_T>
+template<class T>
+std::vector<T> InMemoryTablebase<N, SCORE_T>::readArray(std::istream& i) {
+	uint64 size = 0;
+	i.read(reinterpret_cast<char*>(&size), sizeof(size));
+	std::vector<T> array(i ? size : 0);
+	i.read(reinterpret_cast<char*>(array.data()), array.size() * sizeof(T));
+	return array;
+}
+
+// The snapshot is written next to path first, so an interrupted save leaves the previous snapshot intact
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::saveSnapshot(const std::string& path) const {
+	std::string partialPath = path + ".partial";
+	{
+		std::ofstream file(partialPath, std::ios::binary | std::ios::trunc);
+		SnapshotHeader header{};
+		std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+		header.version = SNAPSHOT_VERSION;
+		header.n = N;
+		header.stateBytes = sizeof(GridState<N>);
+		header.scoreBytes = sizeof(SCORE_T);
+		header.fourChance = this->m_fourChance;
+		header.canonicalKeys = this->m_canonicalKeys;
+		header.edgeQueueInitialized = this->m_edgeQueueInitialized;
+		header.scoreQueueInitialized = this->m_scoreQueueInitialized;
+		header.totalActions = this->m_totalActions;
+		header.nextLayer = m_nextLayer;
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		writeArray(file, m_states.values());
+		writeArray(file, std::vector<char>(m_isNode.begin(), m_isNode.end()));
+		writeArray(file, m_scores);
+		writeArray(file, m_edgeOffsets);
+		writeArray(file, m_edgeTargets);
+		writeArray(file, m_edgeWeights);
+		writeArray(file, m_parentOffsets);
+		writeArray(file, m_parentSources);
+		std::vector<GridState<N>> queuedStates;
+		std::vector<int> queuedDepths;
+		for (const auto& [state, depth] : m_edgeQueue) {
+			queuedStates.push_back(state);
+			queuedDepths.push_back(depth);
+		}
+		writeArray(file, queuedStates);
+		writeArray(file, queuedDepths);
+		writeArray(file, m_layerNodes);
+		writeArray(file, m_layerOffsets);
+		for (const WindowLayer& window : m_window) {
+			writeArray(file, std::vector<uint64>{ window.halfSum, window.begin });
+			writeArray(file, window.scores);
+		}
+		if (!file) throw std::runtime_error("failed to write " + partialPath);
+	}
+	std::filesystem::rename(partialPath, path);
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::loadSnapshot(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) throw std::runtime_error("failed to open " + path);
+	SnapshotHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!file || std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || header.version != SNAPSHOT_VERSION) {
+		throw std::runtime_error(path + " is not a tablebase snapshot of this version");
+	}
+	if (header.n != N || header.stateBytes != sizeof(GridState<N>) || header.scoreBytes != sizeof(SCORE_T)) {
+		throw std::runtime_error(path + " is a snapshot of a different tablebase type");
+	}
+	if (header.fourChance != this->m_fourChance || bool(header.canonicalKeys) != this->m_canonicalKeys) {
+		throw std::runtime_error(path + " is a snapshot of a tablebase with different settings");
+	}
+	std::vector<GridState<N>> states = readArray<GridState<N>>(file);
+	std::vector<char> isNode = readArray<char>(file);
+	auto scores = readArray<std::pair<SCORE_T, SCORE_T>>(file);
+	auto edgeOffsets = readArray<uint64>(file);
+	auto edgeTargets = readArray<uint32>(file);
+	auto edgeWeights = readArray<float>(file);
+	auto parentOffsets = readArray<uint64>(file);
+	auto parentSources = readArray<uint32>(file);
+	auto queuedStates = readArray<GridState<N>>(file);
+	auto queuedDepths = readArray<int>(file);
+	auto layerNodes = readArray<uint32>(file);
+	auto layerOffsets = readArray<uint64>(file);
+	std::array<WindowLayer, 3> window;
+	bool windowValid = true;
+	for (WindowLayer& layer : window) {
+		auto position = readArray<uint64>(file);
+		layer.scores = readArray<std::pair<float, float>>(file);
+		windowValid = windowValid && position.size() == 2 && position[1] + layer.scores.size() <= layerNodes.size();
+		if (position.size() == 2) std::tie(layer.halfSum, layer.begin) = std::make_pair(position[0], position[1]);
+	}
+	if (!file || !windowValid || isNode.size() != states.size() || scores.size() != states.size() || queuedDepths.size() != queuedStates.size()) {
+		throw std::runtime_error(path + " is truncated or corrupt");
+	}
+
+	m_states.replace(std::move(states));
+	m_isNode.assign(isNode.begin(), isNode.end());
+	m_scores = std::move(scores);
+	m_edgeOffsets = std::move(edgeOffsets);
+	m_edgeTargets = std::move(edgeTargets);
+	m_edgeWeights = std::move(edgeWeights);
+	m_parentOffsets = std::move(parentOffsets);
+	m_parentSources = std::move(parentSources);
+	m_edgeQueue.clear();
+	for (uint64 i = 0; i < queuedStates.size(); ++i) m_edgeQueue.emplace_back(queuedStates[i], queuedDepths[i]);
+	m_layerNodes = std::move(layerNodes);
+	m_layerOffsets = std::move(layerOffsets);
+	m_nextLayer = header.nextLayer;
+	m_window = std::move(window);
+	this->m_edgeQueueInitialized = header.edgeQueueInitialized;
+	this->m_scoreQueueInitialized = header.scoreQueueInitialized;
+	this->m_totalActions = header.totalActions;
+	this->m_actionCount = 0;
+}
+
+template<uint N, class SCORE_T>
+void InMemoryTablebase<N, SCORE_T>::dump(std::ostream &o) const {
+	GridState<N> state;
+	for(;;) {
+		state.printCompact(o);
+		o << ": ";
+		GridState<N> node = this->toKey(state);
+		if(hasNode(node)) {
+			o << getNodeScores(node).first << "," << getNodeScores(node).second;
+		} else {
+			o << "-1,-1";
+		}
+		o << std::endl;
+
+		for(uint i = 0;; ++i) {
+			if(i == N*N) return;
+			uint tile = state.readTile(i/N, i%N) + 1;
+			if(tile == N*N+2) {
+				state.writeTile(i/N, i%N, 0);
+			}
+			else {
+				state.writeTile(i/N, i%N, tile);
+				break;
+			}
+		}
+	}
+}
+
+// Stores only nodes and their scores. Children and edge weights are regenerated from a node with ITablebase::expand
+// and parents are found by removing a spawned tile or undoing a swipe with GridState::unswipe, so nothing about
+// edges is kept between calls.
+// Nodes are kept in a ConcurrentMap with both scores of a node packed into its value, so that with more than one
+// thread generateEdges inserts the children of a batch of states from every thread, and calculateScores scores
+// the nodes of a tile sum layer at once as InMemoryTablebase does, updating each score by a compare and swap.
+template<uint N>
+class EdgeFreeTablebase : public TablebaseCore<N, EdgeFreeTablebase<N>> {
+	using Core = TablebaseCore<N, EdgeFreeTablebase<N>>;
+	friend Core;
+	static constexpr bool CORE_SCORING = false;
+public:
+	static_assert(GridState<N>::supportsUnswipe(), "EdgeFreeTablebase finds parents with GridState::unswipe");
+	EdgeFreeTablebase(float fourChance, bool canonicalKeys = false) : Core(fourChance, canonicalKeys) {}
+	virtual void init(uint64 maxActions = UINT64_MAX, int maxDepth = -1) override;
+	virtual float query(const GridState<N>& state) const override;
+protected:
+	void generateEdges(uint64 maxActions, int maxDepth);
+	void calculateScores(uint64 maxActions);
+	void setNode(const GridState<N>& node, float noninterScore = -1, float interScore = -1);
+	bool hasNode(const GridState<N>& node) const;
+	std::pair<float, float> getNodeScores(const GridState<N>& node) const;
+	void pushToEdgeQueue(const GridState<N>& node, int depth);
+	std::pair<GridState<N>, int> popFromEdgeQueue();
+	bool edgeQueueEmpty();
+	void addEdge(const GridState<N>&, const GridState<N>&, float) {}
+	bool hasEdge(const GridState<N>& node) const;
+	void getChildEdges(const GridState<N>& node, std::vector<typename Core::Edge>& edges) const;
+	void getParentEdges(const GridState<N>& child, std::vector<typename Core::Edge>& edges) const;
+	void copyNodesToScoreQueue();
+	void pushToScoreQueue(const GridState<N>& node);
+	GridState<N> popFromScoreQueue();
+	bool scoreQueueEmpty() const;
+	void addInterScore(const GridState<N>& node, float score);
+	void addNonInterScore(const GridState<N>& node, float score);
+private:
+	using NodeMap = ConcurrentMap<GridState<N>>;
+	// value of a node inserted by generateEdgesParallel that has not been pushed to the edge queue yet
+	static constexpr uint64 UNQUEUED = ~uint64(0);
+	static uint64 unscored() { return NodeMap::packScores(std::make_pair(-1.0f, -1.0f)); }
+	// Scores of a node, or -1 for both if state is not a node
+	std::pair<float, float> scoresOrUnknown(const GridState<N>& state) const;
+	// Grows the node map until extra more nodes keep it at most half full
+	void reserveNodes(uint64 extra);
+	// Replaces one score of a node, leaving the other as it is even if another thread changes it meanwhile
+	static void storeScore(std::atomic<uint64>& slot, bool finalScore, float score);
+	void findParents(const GridState<N>& child, std::vector<GridState<N>>& parents) const;
+	void generateEdgesParallel(uint64 maxActions, int maxDepth);
+	// Splits the score queue into tile sum layers, highest first
+	void buildLayers();
+	void calculateScoresLayered(uint64 maxActions);
+	// Scores terminal nodes, and the intermediate score of the others from the final scores of their spawns
+	void scoreIntermediate(const GridState<N>& state);
+	// Final score of a node from the intermediate scores of its swipes, which are in the same layer
+	void scoreFinal(const GridState<N>& state);
+	NodeMap m_nodes;
+	uint64 m_numNodes = 0;
+	std::deque<std::pair<GridState<N>, int>> m_edgeQueue;
+	std::deque<GridState<N>> m_scoreQueue;
+	// layer i of the nodes being scored by layer is m_layerNodes[m_layerOffsets[i]] up to m_layerOffsets[i + 1]
+	std::vector<GridState<N>> m_layerNodes;
+	std::vector<uint64> m_layerOffsets;
+	size_t m_nextLayer = 0;
+	// scratch space for generateEdgesParallel
+	std::vector<std::pair<GridState<N>, int>> m_batch;
+	std::vector<std::vector<std::pair<GridState<N>, float>>> m_batchChildren;
+	std::vector<std::vector<std::atomic<uint64>*>> m_batchSlots;
+	// scratch space for calculateScores
+	std::vector<std::pair<GridState<N>, float>> m_children;
+	std::vector<GridState<N>> m_parents;
+};
+
+template<uint N>
+void EdgeFreeTablebase<N>::init(uint64 maxActions, int maxDepth) {
+	Core::init(maxActions, maxDepth);
+	DEBUG_LOG("node count: " << m_numNodes << std::endl);
+}
+
+template<uint N>
+float EdgeFreeTablebase<N>::query(const GridState<N>& state) const {
+	return scoresOrUnknown(this->toKey(state)).first;
+}
+
+template<uint N>
+std::pair<float, float> EdgeFreeTablebase<N>::scoresOrUnknown(const GridState<N>& state) const {
+	const std::atomic<uint64>* slot = m_nodes.find(state);
+	return slot == nullptr ? std::make_pair(-1.0f, -1.0f) : NodeMap::unpackScores(slot->load(std::memory_order_relaxed));
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::reserveNodes(uint64 extra) {
+	while (2 * (m_numNodes + extra) > m_nodes.capacity()) m_nodes.grow(this->numThreads());
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::storeScore(std::atomic<uint64>& slot, bool finalScore, float score) {
+	uint64 current = slot.load(std::memory_order_relaxed);
+	for (;;) {
+		std::pair<float, float> scores = NodeMap::unpackScores(current);
+		(finalScore ? scores.first : scores.second) = score;
+		if (slot.compare_exchange_weak(current, NodeMap::packScores(scores), std::memory_order_relaxed)) return;
+	}
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::setNode(const GridState<N>& node, float noninterScore, float interScore) {
+	uint64 scores = NodeMap::packScores(std::make_pair(noninterScore, interScore));
+	reserveNodes(1);
+	auto [slot, inserted] = m_nodes.insert(node, scores);
+	if (slot == nullptr) throw std::runtime_error("EdgeFreeTablebase node map probe sequence overflowed");
+	if (inserted) ++m_numNodes;
+	else slot->store(scores, std::memory_order_relaxed);
+}
+
+template<uint N>
+bool EdgeFreeTablebase<N>::hasNode(const GridState<N>& node) const {
+	return m_nodes.find(node) != nullptr;
+}
+
+template<uint N>
+std::pair<float, float> EdgeFreeTablebase<N>::getNodeScores(const GridState<N>& node) const {
+	const std::atomic<uint64>* slot = m_nodes.find(node);
+	if (slot == nullptr) throw std::out_of_range("state is not in the tablebase");
+	return NodeMap::unpackScores(slot->load(std::memory_order_relaxed));
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::pushToEdgeQueue(const GridState<N>& node, int depth) {
+	m_edgeQueue.push_back(std::make_pair(node, depth));
+}
+
+template<uint N>
+std::pair<GridState<N>, int> EdgeFreeTablebase<N>::popFromEdgeQueue() {
+	std::pair<GridState<N>, int> firstElement = m_edgeQueue.front();
+	m_edgeQueue.pop_front();
+	return firstElement;
+}
+
+template<uint N>
+bool EdgeFreeTablebase<N>::edgeQueueEmpty() {
+	return m_edgeQueue.empty();
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::generateEdges(uint64 maxActions, int maxDepth) {
+	if (this->numThreads() > 1) {
+		generateEdgesParallel(maxActions, maxDepth);
+		this->m_totalActions += this->m_actionCount;
+		DEBUG_LOG("generateEdges exiting after " << this->m_actionCount << " actions (" << this->m_totalActions << " total)" << std::endl);
+		this->m_actionCount = 0;
+	}
+	else {
+		Core::generateEdges(maxActions, maxDepth);
+	}
+}
+
+// Pops the edge queue a batch at a time and inserts the children of the batch into the node map from every thread,
+// marking the ones that were not nodes yet. New nodes are then pushed in the order the batch found them, each by
+// the first state to generate it, so the edge queue and every depth are the same as after serial generation.
+template<uint N>
+void EdgeFreeTablebase<N>::generateEdgesParallel(uint64 maxActions, int maxDepth) {
+	while (this->m_actionCount < maxActions && !m_edgeQueue.empty()) {
+		uint64 batchSize = std::min(maxActions - this->m_actionCount, Core::PARALLEL_BATCH_SIZE);
+		m_batch.clear();
+		while (m_batch.size() < batchSize && !m_edgeQueue.empty()) m_batch.push_back(popFromEdgeQueue());
+		if (m_batchChildren.size() < m_batch.size()) {
+			m_batchChildren.resize(m_batch.size());
+			m_batchSlots.resize(m_batch.size());
+		}
+
+		std::atomic<uint64> numChildren = 0;
+		parallelFor(this->numThreads(), m_batch.size(), [this, maxDepth, &numChildren](uint64 i) {
+			m_batchChildren[i].clear();
+			if (maxDepth >= 0 && m_batch[i].second >= maxDepth) return;
+			this->expand(m_batch[i].first, m_batchChildren[i]);
+			numChildren.fetch_add(m_batchChildren[i].size(), std::memory_order_relaxed);
+		});
+		reserveNodes(numChildren);
+		std::atomic<uint64> numInserted = 0;
+		std::atomic<bool> overflowed = false;
+		parallelFor(this->numThreads(), m_batch.size(), [this, &numInserted, &overflowed](uint64 i) {
+			const auto& children = m_batchChildren[i];
+			m_batchSlots[i].resize(children.size());
+			for (uint64 j = 0; j < children.size(); ++j) {
+				auto [slot, inserted] = m_nodes.insert(children[j].first, UNQUEUED);
+				if (slot == nullptr) overflowed = true;
+				if (inserted) numInserted.fetch_add(1, std::memory_order_relaxed);
+				m_batchSlots[i][j] = slot;
+			}
+		});
+		// the map is at most half full, so linear probing never runs this long
+		if (overflowed) throw std::runtime_error("EdgeFreeTablebase node map probe sequence overflowed");
+		m_numNodes += numInserted;
+
+		for (uint64 i = 0; i < m_batch.size(); ++i) {
+			const auto& children = m_batchChildren[i];
+			for (uint64 j = 0; j < children.size(); ++j) {
+				std::atomic<uint64>& slot = *m_batchSlots[i][j];
+				if (slot.load(std::memory_order_relaxed) != UNQUEUED) continue;
+				slot.store(unscored(), std::memory_order_relaxed);
+				pushToEdgeQueue(children[j].first, m_batch[i].second + 1);
+			}
+		}
+		this->m_actionCount += m_batch.size();
+	}
+}
+
+// Every node is expanded during generation, and a state has children unless it is full and has no moves
+template<uint N>
+bool EdgeFreeTablebase<N>::hasEdge(const GridState<N>& node) const {
+	return hasNode(node) && (node.numEmptyTiles() > 0 || node.hasMoves());
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::getChildEdges(const GridState<N>& node, std::vector<typename Core::Edge>& edges) const {
+	edges.clear();
+	if (!hasEdge(node)) return;
+	thread_local std::vector<std::pair<GridState<N>, float>> children;
+	this->expand(node, children);
+	for (const auto& [child, weight] : children) edges.push_back({ child, weight, scoresOrUnknown(child) });
+}
+
+// Each parent is expanded again to find the weight of its edge into child
+template<uint N>
+void EdgeFreeTablebase<N>::getParentEdges(const GridState<N>& child, std::vector<typename Core::Edge>& edges) const {
+	edges.clear();
+	thread_local std::vector<GridState<N>> parents;
+	thread_local std::vector<std::pair<GridState<N>, float>> children;
+	findParents(child, parents);
+	for (const GridState<N>& parent : parents) {
+		this->expand(parent, children);
+		auto edge = std::find_if(children.begin(), children.end(), [&child](const auto& c) { return c.first == child; });
+		if (edge == children.end()) throw std::logic_error("parent does not generate child");
+		edges.push_back({ parent, edge->second, scoresOrUnknown(parent) });
+	}
+}
+
+// A parent either spawned one of the 2s or 4s of the child or swiped into it. In canonical key mode the child
+// key stands for all of its symmetric grids, any of which may be the child the parent generated.
+template<uint N>
+void EdgeFreeTablebase<N>::findParents(const GridState<N>& child, std::vector<GridState<N>>& parents) const {
+	parents.clear();
+	GridState<N> images[8];
+	uint numImages = 0;
+	for (uint symmetry = 0; symmetry < (this->m_canonicalKeys ? 8u : 1u); ++symmetry) {
+		GridState<N> image = child.transformed(symmetry);
+		if (std::find(images, images + numImages, image) == images + numImages) images[numImages++] = image;
+	}
+
+	for (uint i = 0; i < numImages; ++i) {
+		for (uint r = 0; r < N; ++r) {
+			for (uint c = 0; c < N; ++c) {
+				uint tile = images[i].readTile(r, c);
+				if (tile != 1 && tile != 2) continue;
+				GridState<N> parent = images[i];
+				parent.writeTile(r, c, 0);
+				parents.push_back(parent);
+			}
+		}
+		for (uint direction = 0; direction < 4; ++direction) images[i].unswipe(direction, parents);
+	}
+
+	size_t numParents = 0;
+	for (const GridState<N>& parent : parents) {
+		GridState<N> key = this->toKey(parent);
+		if (hasNode(key)) parents[numParents++] = key;
+	}
+	parents.resize(numParents);
+	std::sort(parents.begin(), parents.end());
+	parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::copyNodesToScoreQueue() {
+	m_nodes.forEach([this](const GridState<N>& node, uint64) { m_scoreQueue.push_front(node); });
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::pushToScoreQueue(const GridState<N>& node) {
+	m_scoreQueue.push_back(node);
+}
+
+template<uint N>
+GridState<N> EdgeFreeTablebase<N>::popFromScoreQueue() {
+	GridState<N> firstElement = m_scoreQueue.front();
+	m_scoreQueue.pop_front();
+	return firstElement;
+}
+
+// True once neither the score queue nor the layers hold a node to score
+template<uint N>
+bool EdgeFreeTablebase<N>::scoreQueueEmpty() const {
+	return m_scoreQueue.empty() && m_nextLayer + 1 >= m_layerOffsets.size();
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::addInterScore(const GridState<N>& node, float score) {
+	storeScore(*m_nodes.find(node), false, score);
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::addNonInterScore(const GridState<N>& node, float score) {
+	storeScore(*m_nodes.find(node), true, score);
+}
+
+// TablebaseCore::calculateScores expanding each node once instead of looking up every edge weight separately. With
+// more than one thread, the score queue is split into layers and scored as in InMemoryTablebase instead.
+template<uint N>
+void EdgeFreeTablebase<N>::calculateScores(uint64 maxActions) {
+	if (this->numThreads() > 1 && !m_scoreQueue.empty()) buildLayers();
+	if (m_nextLayer + 1 < m_layerOffsets.size()) {
+		calculateScoresLayered(maxActions);
+		return;
+	}
+	for (; this->m_actionCount < maxActions && !m_scoreQueue.empty(); ++this->m_actionCount) {
+		GridState<N> state = m_scoreQueue.front();
+		m_scoreQueue.pop_front();
+		std::atomic<uint64>& slot = *m_nodes.find(state);
+		auto [scoreFinal, scoreInter] = NodeMap::unpackScores(slot.load(std::memory_order_relaxed));
+		if (scoreFinal != -1.0f && scoreInter != -1.0f) continue;
+
+		bool foundScore = false;
+		if (state.hasTile(N * N + 1)) {
+			slot.store(NodeMap::packScores(std::make_pair(1.0f, 1.0f)), std::memory_order_relaxed);
+			foundScore = true;
+		}
+		else if (!state.hasMoves() && state != GridState<N>()) {
+			slot.store(NodeMap::packScores(std::make_pair(0.0f, 0.0f)), std::memory_order_relaxed);
+			foundScore = true;
+		}
+		else if (!hasEdge(state)) {
+			DEBUG_LOG("I thought me were generating to infinite depth....");
+			DEBUG_ASSERT(0);
+			slot.store(NodeMap::packScores(std::make_pair(0.5f, 0.5f)), std::memory_order_relaxed);
+			foundScore = true;
+		}
+		else {
+			this->expand(state, m_children);
+			if (scoreFinal == -1.0f) {
+				bool readyToCalculate = true;
+				float score = 0.0f;
+				for (const auto& [child, weight] : m_children) {
+					if (weight != -1) continue;
+					float childScore = scoresOrUnknown(child).second;
+					if (childScore == -1) {
+						readyToCalculate = false;
+						break;
 					}
+					score = std::max(score, childScore);
 				}
 				if (readyToCalculate) {
-					addInterScore(state, score);
+					storeScore(slot, true, score);
+					foundScore = true;
+				}
+			}
+			if (scoreInter == -1.0f) {
+				bool readyToCalculate = true;
+				float score = 0.0f;
+				for (const auto& [child, weight] : m_children) {
+					if (weight == -1) continue;
+					float childScore = scoresOrUnknown(child).first;
+					if (childScore == -1) {
+						readyToCalculate = false;
+						break;
+					}
+					score += weight * childScore;
+				}
+				if (readyToCalculate) {
+					storeScore(slot, false, score);
 					foundScore = true;
 				}
 			}
 		}
 		if (foundScore) {
-			for (const GridState<N>& prevState : getParents(state)) {
-				auto [prevScoreFinal, prevScoreInter] = getNodeScores(prevState);
-				if (prevScoreFinal == -1.0f || prevScoreInter == -1.0f) {
-					pushToScoreQueue(prevState);
+			findParents(state, m_parents);
+			for (const GridState<N>& parent : m_parents) {
+				auto [parentFinal, parentInter] = getNodeScores(parent);
+				if (parentFinal == -1.0f || parentInter == -1.0f) m_scoreQueue.push_back(parent);
+			}
+		}
+	}
+	this->m_totalActions += this->m_actionCount;
+	DEBUG_LOG("calculateScores exiting after " << this->m_actionCount << " actions (" << this->m_totalActions << " total)" << std::endl);
+	this->m_actionCount = 0;
+}
+
+// Layers already being scored keep their nodes, so only queued nodes that are not scored yet are added
+template<uint N>
+void EdgeFreeTablebase<N>::buildLayers() {
+	m_layerNodes.erase(m_layerNodes.begin(), m_layerNodes.begin() + (m_nextLayer < m_layerOffsets.size() ? m_layerOffsets[m_nextLayer] : m_layerNodes.size()));
+	for (const GridState<N>& node : m_scoreQueue) {
+		auto [scoreFinal, scoreInter] = getNodeScores(node);
+		if (scoreFinal == -1.0f || scoreInter == -1.0f) m_layerNodes.push_back(node);
+	}
+	m_scoreQueue.clear();
+	std::sort(m_layerNodes.begin(), m_layerNodes.end(), [](const GridState<N>& a, const GridState<N>& b) {
+		uint64 sumA = a.tileSum(), sumB = b.tileSum();
+		return sumA != sumB ? sumA > sumB : a < b;
+	});
+	m_layerNodes.erase(std::unique(m_layerNodes.begin(), m_layerNodes.end()), m_layerNodes.end());
+	m_layerOffsets.clear();
+	for (uint64 i = 0; i < m_layerNodes.size(); ++i) {
+		if (i == 0 || m_layerNodes[i].tileSum() != m_layerNodes[i - 1].tileSum()) m_layerOffsets.push_back(i);
+	}
+	m_layerOffsets.push_back(m_layerNodes.size());
+	m_nextLayer = 0;
+}
+
+// Scores one layer per step, highest tile sum first. Every node of a layer counts as one action, and the layer
+// in progress is always finished.
+template<uint N>
+void EdgeFreeTablebase<N>::calculateScoresLayered(uint64 maxActions) {
+	for (; this->m_actionCount < maxActions && m_nextLayer + 1 < m_layerOffsets.size(); ++m_nextLayer) {
+		const GridState<N>* layer = m_layerNodes.data() + m_layerOffsets[m_nextLayer];
+		uint64 layerSize = m_layerOffsets[m_nextLayer + 1] - m_layerOffsets[m_nextLayer];
+		parallelFor(this->numThreads(), layerSize, [this, layer](uint64 i) { scoreIntermediate(layer[i]); });
+		parallelFor(this->numThreads(), layerSize, [this, layer](uint64 i) { scoreFinal(layer[i]); });
+		this->m_actionCount += layerSize;
+	}
+	this->m_totalActions += this->m_actionCount;
+	DEBUG_LOG("calculateScores exiting after " << this->m_actionCount << " actions (" << this->m_totalActions << " total)" << std::endl);
+	this->m_actionCount = 0;
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::scoreIntermediate(const GridState<N>& state) {
+	std::atomic<uint64>& slot = *m_nodes.find(state);
+	auto [scoreFinal, scoreInter] = NodeMap::unpackScores(slot.load(std::memory_order_relaxed));
+	if (scoreFinal != -1.0f && scoreInter != -1.0f) return;
+
+	if (state.hasTile(N * N + 1)) {
+		slot.store(NodeMap::packScores(std::make_pair(1.0f, 1.0f)), std::memory_order_relaxed);
+	}
+	else if (!state.hasMoves() && state != GridState<N>()) {
+		slot.store(NodeMap::packScores(std::make_pair(0.0f, 0.0f)), std::memory_order_relaxed);
+	}
+	else if (scoreInter == -1.0f) {
+		thread_local std::vector<std::pair<GridState<N>, float>> children;
+		this->expand(state, children);
+		float score = 0.0f;
+		for (const auto& [child, weight] : children) {
+			if (weight == -1) continue;
+			float childScore = scoresOrUnknown(child).first;
+			// a child cut off by maxDepth is never scored
+			if (childScore == -1) return;
+			score += weight * childScore;
+		}
+		storeScore(slot, false, score);
+	}
+}
+
+template<uint N>
+void EdgeFreeTablebase<N>::scoreFinal(const GridState<N>& state) {
+	std::atomic<uint64>& slot = *m_nodes.find(state);
+	if (NodeMap::unpackScores(slot.load(std::memory_order_relaxed)).first != -1.0f) return;
+	auto moves = state.allMoves();
+	float score = 0.0f;
+	for (uint i = 0; i < 4; ++i) {
+		if (!moves.moved(i)) continue;
+		float childScore = scoresOrUnknown(this->toKey(moves.children[i])).second;
+		if (childScore == -1) return;
+		score = std::max(score, childScore);
+	}
+	storeScore(slot, true, score);
+}
+
+// Generates and scores a tablebase one tile sum layer at a time, so that only a few layers are in memory at once.
+// Every child of a node is in the node's layer or one of the next two, so a layer is complete once it and the two
+// layers below it are expanded. Complete layers are written to sorted files in a directory. Scoring streams them
+// back from the highest tile sum down, keeping only the two layers above the one being scored. As in
+// EdgeFreeTablebase, no edges are stored and children are regenerated with expandState. Layers are scored in full
+// precision and their score files store SCORE_T, so a fixed point type only rounds each score once.
+template<uint N, class SCORE_T = float>
+class StreamingTablebase {
+public:
+	StreamingTablebase(float fourChance, const std::string& directory, bool canonicalKeys = false);
+	void init();
+	// Looks the state up in the files of its layer, -1 if it is not a node
+	float query(const GridState<N>& state) const { return scores(state).first; }
+	std::pair<int, int> bestMove(const GridState<N>& state) const;
+	void setNumThreads(uint numThreads) { m_numThreads = std::max(numThreads, 1u); }
+	// Most nodes init held in memory at once
+	uint64 peakNodesInMemory() const { return m_peakNodes; }
+private:
+	// Nodes of one layer in ascending order, with their final and intermediate scores
+	struct Layer {
+		std::vector<GridState<N>> nodes;
+		std::vector<std::pair<float, float> /*final_score, intermediate_score*/> scores;
+		const std::pair<float, float>& scoresOf(const GridState<N>& node) const {
+			auto it = std::lower_bound(nodes.begin(), nodes.end(), node);
+			assert(it != nodes.end() && *it == node);
+			return scores[it - nodes.begin()];
+		}
+	};
+	// states expanded together while generating a layer
+	static constexpr uint64 BATCH_SIZE = 1 << 16;
+	GridState<N> toKey(const GridState<N>& state) const { return m_canonicalKeys ? state.canonical().first : state; }
+	void generate();
+	void solve();
+	// Scores of a node read from the files of its layer, -1 for both if state is not a node
+	std::pair<float, float> scores(const GridState<N>& state) const;
+	std::filesystem::path layerPath(uint64 tileSum, const char* extension) const;
+	void writeNodes(uint64 tileSum, const std::vector<GridState<N>>& nodes) const;
+	std::vector<GridState<N>> readNodes(uint64 tileSum) const;
+	void writeScores(uint64 tileSum, const std::vector<std::pair<float, float>>& scores) const;
+	using Codec = ScoreCodec<SCORE_T>;
+	const float m_fourChance;
+	const bool m_canonicalKeys;
+	const std::filesystem::path m_directory;
+	uint m_numThreads;
+	// tile sums of the layers on disk in ascending order
+	std::vector<uint64> m_tileSums;
+	uint64 m_peakNodes;
+};
+
+template<uint N, class SCORE_T>
+StreamingTablebase<N, SCORE_T>::StreamingTablebase(float fourChance, const std::string& directory, bool canonicalKeys)
+	: m_fourChance(fourChance), m_canonicalKeys(canonicalKeys), m_directory(directory), m_numThreads{ 1 }, m_peakNodes{ 0 } {
+	std::filesystem::create_directories(m_directory);
+}
+
+template<uint N, class SCORE_T>
+void StreamingTablebase<N, SCORE_T>::init() {
+	generate();
+	solve();
+	DEBUG_LOG("layer count: " << m_tileSums.size() << " peak nodes in memory: " << m_peakNodes << std::endl);
+}
+
+template<uint N, class SCORE_T>
+std::filesystem::path StreamingTablebase<N, SCORE_T>::layerPath(uint64 tileSum, const char* extension) const {
+	return m_directory / (std::to_string(tileSum) + extension);
+}
+
+template<uint N, class SCORE_T>
+void StreamingTablebase<N, SCORE_T>::writeNodes(uint64 tileSum, const std::vector<GridState<N>>& nodes) const {
+	std::ofstream file(layerPath(tileSum, ".nodes"), std::ios::binary | std::ios::trunc);
+	for (const GridState<N>& node : nodes) file.write(static_cast<const char*>(node.gridData()), GridState<N>::GRID_DATA_BYTES);
+	if (!file) throw std::runtime_error("failed to write " + layerPath(tileSum, ".nodes").string());
+}
+
+template<uint N, class SCORE_T>
+std::vector<GridState<N>> StreamingTablebase<N, SCORE_T>::readNodes(uint64 tileSum) const {
+	std::ifstream file(layerPath(tileSum, ".nodes"), std::ios::binary);
+	if (!file) throw std::runtime_error("failed to open " + layerPath(tileSum, ".nodes").string());
+	std::vector<GridState<N>> nodes(std::filesystem::file_size(layerPath(tileSum, ".nodes")) / GridState<N>::GRID_DATA_BYTES);
+	for (GridState<N>& node : nodes) file.read(static_cast<char*>(node.gridData()), GridState<N>::GRID_DATA_BYTES);
+	if (!file) throw std::runtime_error("failed to read " + layerPath(tileSum, ".nodes").string());
+	return nodes;
+}
+
+template<uint N, class SCORE_T>
+void StreamingTablebase<N, SCORE_T>::writeScores(uint64 tileSum, const std::vector<std::pair<float, float>>& scores) const {
+	std::ofstream file(layerPath(tileSum, ".scores"), std::ios::binary | std::ios::trunc);
+	for (const auto& [scoreFinal, scoreInter] : scores) {
+		SCORE_T stored[2] = { Codec::encode(scoreFinal), Codec::encode(scoreInter) };
+		file.write(reinterpret_cast<const char*>(stored), sizeof(stored));
+	}
+	if (!file) throw std::runtime_error("failed to write " + layerPath(tileSum, ".scores").string());
+}
+
+// Layers waiting to be completed are kept in open, at most the one being expanded and the two above it
+template<uint N, class SCORE_T>
+void StreamingTablebase<N, SCORE_T>::generate() {
+	std::map<uint64, ankerl::unordered_dense::set<GridState<N>>> open;
+	open[0].insert(GridState<N>());
+	std::vector<std::vector<std::pair<GridState<N>, float>>> children(BATCH_SIZE);
+	m_tileSums.clear();
+	while (!open.empty()) {
+		auto layerIt = open.begin();
+		auto& layer = layerIt->second;
+		// swipes add nodes to the layer being expanded, which are expanded in later batches
+		for (uint64 expanded = 0; expanded < layer.size();) {
+			uint64 batchSize = std::min<uint64>(layer.size() - expanded, BATCH_SIZE);
+			parallelFor(m_numThreads, batchSize, [&](uint64 i) {
+				expandState(layer.values()[expanded + i], m_fourChance, m_canonicalKeys, children[i]);
+			});
+			for (uint64 i = 0; i < batchSize; ++i) {
+				for (const auto& [child, weight] : children[i]) {
+					if (weight == -1) layer.insert(child);
+					else open[child.tileSum()].insert(child);
 				}
 			}
+			expanded += batchSize;
+			uint64 nodesInMemory = 0;
+			for (const auto& [tileSum, nodes] : open) nodesInMemory += nodes.size();
+			m_peakNodes = std::max(m_peakNodes, nodesInMemory);
+		}
+		std::vector<GridState<N>> nodes(layer.values().begin(), layer.values().end());
+		std::sort(nodes.begin(), nodes.end());
+		writeNodes(layerIt->first, nodes);
+		m_tileSums.push_back(layerIt->first);
+		open.erase(layerIt);
+	}
+}
+
+// A layer's intermediate scores only need the final scores of its spawns, which are in the two layers above. Its
+// final scores then only need the intermediate scores of its swipes, which are in the layer itself.
+template<uint N, class SCORE_T>
+void StreamingTablebase<N, SCORE_T>::solve() {
+	std::map<uint64, Layer> window;
+	for (auto it = m_tileSums.rbegin(); it != m_tileSums.rend(); ++it) {
+		uint64 tileSum = *it;
+		Layer layer;
+		layer.nodes = readNodes(tileSum);
+		layer.scores.assign(layer.nodes.size(), std::make_pair(-1.0f, -1.0f));
+
+		parallelFor(m_numThreads, layer.nodes.size(), [&](uint64 i) {
+			thread_local std::vector<std::pair<GridState<N>, float>> children;
+			const GridState<N>& state = layer.nodes[i];
+			if (state.hasTile(N * N + 1)) {
+				layer.scores[i] = std::make_pair(1.0f, 1.0f);
+			}
+			else if (!state.hasMoves() && state != GridState<N>()) {
+				layer.scores[i] = std::make_pair(0.0f, 0.0f);
+			}
+			else {
+				expandState(state, m_fourChance, m_canonicalKeys, children);
+				float score = 0.0f;
+				for (const auto& [child, weight] : children) {
+					if (weight != -1) score += weight * window.at(child.tileSum()).scoresOf(child).first;
+				}
+				layer.scores[i].second = score;
+			}
+		});
+		parallelFor(m_numThreads, layer.nodes.size(), [&](uint64 i) {
+			if (layer.scores[i].first != -1.0f) return;
+			auto moves = layer.nodes[i].allMoves();
+			float score = 0.0f;
+			for (uint d = 0; d < 4; ++d) {
+				if (moves.moved(d)) score = std::max(score, layer.scoresOf(toKey(moves.children[d])).second);
+			}
+			layer.scores[i].first = score;
+		});
+
+		writeScores(tileSum, layer.scores);
+		window.erase(window.upper_bound(tileSum + 2), window.end());
+		window.emplace(tileSum, std::move(layer));
+	}
+}
+
+// Binary search over the node file of the state's layer
+template<uint N, class SCORE_T>
+std::pair<float, float> StreamingTablebase<N, SCORE_T>::scores(const GridState<N>& state) const {
+	GridState<N> node = toKey(state);
+	uint64 tileSum = node.tileSum();
+	std::ifstream nodes(layerPath(tileSum, ".nodes"), std::ios::binary);
+	if (!nodes) return std::make_pair(-1.0f, -1.0f);
+	uint64 begin = 0;
+	uint64 end = std::filesystem::file_size(layerPath(tileSum, ".nodes")) / GridState<N>::GRID_DATA_BYTES;
+	while (begin < end) {
+		uint64 middle = begin + (end - begin) / 2;
+		GridState<N> candidate;
+		nodes.seekg(middle * GridState<N>::GRID_DATA_BYTES);
+		nodes.read(static_cast<char*>(candidate.gridData()), GridState<N>::GRID_DATA_BYTES);
+		if (!nodes) throw std::runtime_error("failed to read " + layerPath(tileSum, ".nodes").string());
+		if (candidate == node) {
+			std::ifstream scores(layerPath(tileSum, ".scores"), std::ios::binary);
+			SCORE_T stored[2];
+			scores.seekg(middle * sizeof(stored));
+			scores.read(reinterpret_cast<char*>(stored), sizeof(stored));
+			if (!scores) throw std::runtime_error("failed to read " + layerPath(tileSum, ".scores").string());
+			return std::make_pair(Codec::decode(stored[0]), Codec::decode(stored[1]));
 		}
+		if (candidate < node) begin = middle + 1;
+		else end = middle;
 	}
-	m_totalActions += m_actionCount;
-	DEBUG_LOG("calculateScores exiting after " << m_actionCount << " actions (" << m_totalActions << " total)" << std::endl);
-	m_actionCount = 0;
+	return std::make_pair(-1.0f, -1.0f);
 }
 
-template<uint N>
-std::pair<int, int> ITablebase<N>::bestMove(const GridState<N>& state) const {
+template<uint N, class SCORE_T>
+std::pair<int, int> StreamingTablebase<N, SCORE_T>::bestMove(const GridState<N>& state) const {
+	auto [node, symmetry] = m_canonicalKeys ? state.canonical() : std::make_pair(state, 0u);
 	float bestScore = 0;
-	GridState<N> bestState;
-	if (hasEdge(state)) {
-		std::vector<GridState<N>> children = getEdges(state);
-		// find best intermediate child score
-		for (const GridState<N>& child : children) {
-			if (getEdgeWeight(state, child) != -1) continue;
-			float score = getNodeScores(child).second;
-			if (score > bestScore) {
-				bestScore = score;
-				bestState = child;
+	int bestDirection = -1;
+	auto moves = node.allMoves();
+	for (uint i = 0; i < 4; ++i) {
+		if (!moves.moved(i)) continue;
+		float score = scores(moves.children[i]).second;
+		if (score > bestScore) {
+			bestScore = score;
+			bestDirection = i;
+		}
+	}
+	return bestDirection < 0 ? std::make_pair(-1, -1) : GridState<N>::untransformMove(MOVE_DIRECTIONS[bestDirection], symmetry);
+}
+
+// Scores of every grid with tiles up to the win tile, kept in flat arrays indexed by StateRanking, so a query is a
+// rank computation and an array read. Grids are scored whether they are reachable or not, so this only suits boards
+// small enough to rank. Layers are scored from the highest tile sum down as in InMemoryTablebase, iterating the
+// grids of a layer by index instead of by edges. Scores are stored as SCORE_T. With a fixed point type, the layers a
+// layer is solved from are also kept in full precision, so every score is rounded once.
+template<uint N, class SCORE_T = float>
+class RankedTablebase {
+public:
+	RankedTablebase(float fourChance) : m_fourChance(fourChance), m_numThreads{ 1 } {}
+	void init();
+	// -1 for grids with tiles above the win tile
+	float query(const GridState<N>& state) const;
+	std::pair<int, int> bestMove(const GridState<N>& state) const;
+	void setNumThreads(uint numThreads) { m_numThreads = std::max(numThreads, 1u); }
+	uint64 numStates() const { return m_ranking.numStates(); }
+private:
+	void scoreIntermediate(uint64 index, uint64 halfSum);
+	void scoreFinal(uint64 index, uint64 halfSum);
+	using Codec = ScoreCodec<SCORE_T>;
+	static constexpr bool ROUNDS = !std::is_floating_point_v<SCORE_T>;
+	// Full precision final and intermediate scores of a grid whose layer is in the window
+	std::pair<float, float>& windowScores(uint64 index, uint64 halfSum) { return m_window[halfSum % 3][index - m_ranking.layerBegin(halfSum)]; }
+	float finalScoreOf(uint64 index, uint64 halfSum) { return ROUNDS ? windowScores(index, halfSum).first : Codec::decode(m_finalScores[index]); }
+	float interScoreOf(uint64 index, uint64 halfSum) { return ROUNDS ? windowScores(index, halfSum).second : Codec::decode(m_interScores[index]); }
+	void storeFinal(uint64 index, uint64 halfSum, float score);
+	void storeInter(uint64 index, uint64 halfSum, float score);
+	const float m_fourChance;
+	uint m_numThreads;
+	StateRanking<N> m_ranking;
+	std::vector<SCORE_T> m_finalScores;
+	std::vector<SCORE_T> m_interScores;
+	// layer being scored and the two above it, which hold its spawns, by half tile sum modulo 3. Only kept if ROUNDS.
+	std::array<std::vector<std::pair<float, float>>, 3> m_window;
+};
+
+template<uint N, class SCORE_T>
+void RankedTablebase<N, SCORE_T>::init() {
+	m_finalScores.assign(numStates(), Codec::encode(-1.0f));
+	m_interScores.assign(numStates(), Codec::encode(-1.0f));
+	for (uint64 halfSum = StateRanking<N>::MAX_SUM + 1; halfSum-- > 0;) {
+		uint64 begin = m_ranking.layerBegin(halfSum);
+		uint64 layerSize = m_ranking.layerEnd(halfSum) - begin;
+		if constexpr (ROUNDS) m_window[halfSum % 3].assign(layerSize, std::make_pair(-1.0f, -1.0f));
+		parallelFor(m_numThreads, layerSize, [this, begin, halfSum](uint64 i) { scoreIntermediate(begin + i, halfSum); });
+		parallelFor(m_numThreads, layerSize, [this, begin, halfSum](uint64 i) { scoreFinal(begin + i, halfSum); });
+	}
+	for (auto& layer : m_window) layer = {};
+	DEBUG_LOG("ranked state count: " << numStates() << std::endl);
+}
+
+template<uint N, class SCORE_T>
+void RankedTablebase<N, SCORE_T>::storeFinal(uint64 index, uint64 halfSum, float score) {
+	m_finalScores[index] = Codec::encode(score);
+	if constexpr (ROUNDS) windowScores(index, halfSum).first = score;
+}
+
+template<uint N, class SCORE_T>
+void RankedTablebase<N, SCORE_T>::storeInter(uint64 index, uint64 halfSum, float score) {
+	m_interScores[index] = Codec::encode(score);
+	if constexpr (ROUNDS) windowScores(index, halfSum).second = score;
+}
+
+// Spawns are in the two layers above, which are already scored. A 2 adds 1 to the half tile sum and a 4 adds 2.
+template<uint N, class SCORE_T>
+void RankedTablebase<N, SCORE_T>::scoreIntermediate(uint64 index, uint64 halfSum) {
+	GridState<N> state = m_ranking.unrank(index);
+	if (state.hasTile(N * N + 1)) {
+		storeFinal(index, halfSum, 1.0f);
+		storeInter(index, halfSum, 1.0f);
+		return;
+	}
+	if (!state.hasMoves() && state != GridState<N>()) {
+		storeFinal(index, halfSum, 0.0f);
+		storeInter(index, halfSum, 0.0f);
+		return;
+	}
+	uint emptyTiles = state.numEmptyTiles();
+	float score = 0.0f;
+	for (uint r = 0; r < N; ++r) {
+		for (uint c = 0; c < N; ++c) {
+			if (!state.isEmpty(r, c)) continue;
+			for (uint i = 0; i < 2; ++i) {
+				GridState<N> child = state;
+				child.writeTile(r, c, i + 1);
+				score += (i ? m_fourChance : (1.0f - m_fourChance)) / emptyTiles * finalScoreOf(m_ranking.rank(child), halfSum + i + 1);
 			}
 		}
 	}
+	storeInter(index, halfSum, score);
+}
+
+// Swipes stay in the layer, whose intermediate scores are all known by now
+template<uint N, class SCORE_T>
+void RankedTablebase<N, SCORE_T>::scoreFinal(uint64 index, uint64 halfSum) {
+	if (finalScoreOf(index, halfSum) != -1.0f) return;
+	auto moves = m_ranking.unrank(index).allMoves();
+	float score = 0.0f;
 	for (uint i = 0; i < 4; ++i) {
-		GridState<N> stateClone = state;
-		std::pair<int, int> swipeMove;
-		switch (i) {
-		case 0: swipeMove = std::make_pair(0, -1); break;
-		case 1: swipeMove = std::make_pair(0, 1); break;
-		case 2: swipeMove = std::make_pair(-1, 0); break;
-		case 3: swipeMove = std::make_pair(1, 0); break;
-		}
-		stateClone.swipe(swipeMove.first, swipeMove.second);
-		if (stateClone == bestState) {
-			return swipeMove;
-		}
+		if (moves.moved(i)) score = std::max(score, interScoreOf(m_ranking.rank(moves.children[i]), halfSum));
 	}
-	return std::make_pair(-1, -1);
+	storeFinal(index, halfSum, score);
 }
 
-template<uint N>
-void ITablebase<N>::recursiveQuery(const GridState<N>& state, int currDepth, int maxDepth, QueryResultsType<N>& results) const {
-	if (currDepth > maxDepth) return;
-	bool intermediate = currDepth & 1;
-	auto scores = getNodeScores(state);
-	results.emplace_back(std::make_tuple(currDepth, state, intermediate ? scores.second : scores.first));
-	if (hasEdge(state)) {
-		auto children = getEdges(state);
-		for (const auto& child : children) {
-			float edgeWeight = getEdgeWeight(state, child);
-			if ((!intermediate && edgeWeight != -1.0f) || (intermediate && edgeWeight == -1.0f)) continue;
-			recursiveQuery(child, currDepth + 1, maxDepth, results);
+template<uint N, class SCORE_T>
+float RankedTablebase<N, SCORE_T>::query(const GridState<N>& state) const {
+	if (state.maxTile() > N * N + 1) return -1.0f;
+	return Codec::decode(m_finalScores[m_ranking.rank(state)]);
+}
+
+template<uint N, class SCORE_T>
+std::pair<int, int> RankedTablebase<N, SCORE_T>::bestMove(const GridState<N>& state) const {
+	if (state.maxTile() > N * N + 1) return std::make_pair(-1, -1);
+	float bestScore = 0;
+	int bestDirection = -1;
+	auto moves = state.allMoves();
+	for (uint i = 0; i < 4; ++i) {
+		// merging two win tiles leaves the ranked grids
+		if (!moves.moved(i) || moves.children[i].maxTile() > N * N + 1) continue;
+		float score = Codec::decode(m_interScores[m_ranking.rank(moves.children[i])]);
+		if (score > bestScore) {
+			bestScore = score;
+			bestDirection = i;
 		}
 	}
+	return bestDirection < 0 ? std::make_pair(-1, -1) : MOVE_DIRECTIONS[bestDirection];
 }
 
+// Scores states on demand by a memoized expectimax from the queried state, without generating the tablebase first.
+// Final and intermediate scores of the nodes visited are kept in a cache of at most cacheEntries nodes, which later
+// queries reuse. Once the cache is full a CLOCK hand evicts a node that has not been read since the hand last
+// passed it. A query costs as much as the part of the state graph below it that is not cached, so states late in a
+// game answer quickly, while an early state can touch most of the graph. query and bestMove update the cache and
+// must not be called concurrently.
 template<uint N>
-class InMemoryTablebase : public ITablebase<N> {
+class LazyTablebase {
 public:
-	InMemoryTablebase(float fourChance) : ITablebase<N>(fourChance) {}
-	virtual void init(uint64 maxActions = UINT64_MAX, int maxDepth = -1) override;
-	virtual float query(const GridState<N>& state) const override;
-	void dump(std::ostream &o) const;
-protected:
-	virtual void setNode(const GridState<N>& node, float noninterScore = -1, float interScore = -1) override;
-	virtual bool hasNode(const GridState<N>& node) const override;
-	virtual std::pair<float, float> getNodeScores(const GridState<N>& node) const override;
-	virtual void pushToEdgeQueue(const GridState<N>& node, int depth) override;
-	virtual std::pair<GridState<N>, int> popFromEdgeQueue() override;
-	virtual bool edgeQueueEmpty() override;
-	virtual void addEdge(const GridState<N>& parent, const GridState<N>& child, float weight) override;
-	virtual bool hasEdge(const GridState<N>& node) const override;
-	virtual std::vector<GridState<N>> getEdges(const GridState<N>& node) const override;
-	virtual float getEdgeWeight(const GridState<N>& parent, const GridState<N>& child) const override;
-	virtual std::vector<GridState<N>> getParents(const GridState<N>& child) const override;
-	virtual void copyNodesToScoreQueue() override;
-	virtual void pushToScoreQueue(const GridState<N>& node) override;
-	virtual GridState<N> popFromScoreQueue() override;
-	virtual bool scoreQueueEmpty() const override;
-	virtual void addInterScore(const GridState<N>&node, float score) override;
-	virtual void addNonInterScore(const GridState<N>& node, float score) override;
+	LazyTablebase(float fourChance, uint64 cacheEntries = 1 << 22, bool canonicalKeys = false);
+	float query(const GridState<N>& state) const { return finalScore(toKey(state)); }
+	std::pair<int, int> bestMove(const GridState<N>& state) const;
+	uint64 numCached() const { return m_entries.size(); }
 private:
-	ankerl::unordered_dense::map<GridState<N>, std::pair<float,float> /*final_score, intermediate_score*/> m_nodes;
-	ankerl::unordered_dense::map<GridState<N>, ankerl::unordered_dense::map<GridState<N>, float>> m_edges;
-	ankerl::unordered_dense::map<GridState<N>, std::vector<GridState<N>>> m_reverseEdges;
-	ankerl::unordered_dense::set<std::pair<GridState<N>, bool>> m_edgesGenerated;
-	std::deque<std::pair<GridState<N>, int>> m_edgeQueue;
-	std::deque<GridState<N>> m_scoreQueue;
+	struct Entry {
+		GridState<N> node;
+		float finalScore;
+		float interScore;
+		// read since the CLOCK hand last passed
+		bool referenced;
+	};
+	GridState<N> toKey(const GridState<N>& state) const { return m_canonicalKeys ? state.canonical().first : state; }
+	float finalScore(const GridState<N>& node) const;
+	float interScore(const GridState<N>& node) const;
+	// The cached entry of node, or a null pointer, which is only valid until the next store
+	Entry* lookup(const GridState<N>& node) const;
+	void store(const GridState<N>& node, float finalScore, float interScore) const;
+	const float m_fourChance;
+	const bool m_canonicalKeys;
+	const uint64 m_cacheEntries;
+	mutable std::vector<Entry> m_entries;
+	mutable ankerl::unordered_dense::map<GridState<N>, uint64> m_slots;
+	mutable uint64 m_hand;
 };
 
 template<uint N>
-void InMemoryTablebase<N>::init(uint64 maxActions, int maxDepth) {
-	ITablebase<N>::init(maxActions, maxDepth);
-	DEBUG_LOG("node count: " << m_nodes.size() << " edge count: " << m_edges.size() << std::endl);
+LazyTablebase<N>::LazyTablebase(float fourChance, uint64 cacheEntries, bool canonicalKeys)
+	: m_fourChance(fourChance), m_canonicalKeys(canonicalKeys), m_cacheEntries(std::max<uint64>(cacheEntries, 1)), m_hand{ 0 } {
+	m_entries.reserve(m_cacheEntries);
+	m_slots.reserve(m_cacheEntries);
 }
 
 template<uint N>
-float InMemoryTablebase<N>::query(const GridState<N>& state) const {
-	auto it = m_nodes.find(state);
-	return it == m_nodes.end() ? -1.0f : it->second.first;
+typename LazyTablebase<N>::Entry* LazyTablebase<N>::lookup(const GridState<N>& node) const {
+	auto it = m_slots.find(node);
+	if (it == m_slots.end()) return nullptr;
+	Entry& entry = m_entries[it->second];
+	entry.referenced = true;
+	return &entry;
 }
 
 template<uint N>
-void InMemoryTablebase<N>::setNode(const GridState<N>& node, float noninterScore, float interScore) {
-	m_nodes[node] = std::make_pair(noninterScore, interScore);
+void LazyTablebase<N>::store(const GridState<N>& node, float finalScore, float interScore) const {
+	if (Entry* entry = lookup(node)) {
+		if (finalScore != -1.0f) entry->finalScore = finalScore;
+		if (interScore != -1.0f) entry->interScore = interScore;
+		return;
+	}
+	if (m_entries.size() < m_cacheEntries) {
+		m_slots.emplace(node, m_entries.size());
+		m_entries.push_back(Entry{ node, finalScore, interScore, false });
+		return;
+	}
+	for (; m_entries[m_hand].referenced; m_hand = (m_hand + 1) % m_entries.size()) {
+		m_entries[m_hand].referenced = false;
+	}
+	m_slots.erase(m_entries[m_hand].node);
+	m_slots.emplace(node, m_hand);
+	m_entries[m_hand] = Entry{ node, finalScore, interScore, false };
+	m_hand = (m_hand + 1) % m_entries.size();
 }
 
+// The best intermediate score of a swipe, swipes keeping the tile sum of the node
 template<uint N>
-bool InMemoryTablebase<N>::hasNode(const GridState<N>& node) const {
-	return m_nodes.count(node) == 1;
+float LazyTablebase<N>::finalScore(const GridState<N>& node) const {
+	if (const Entry* entry = lookup(node); entry && entry->finalScore != -1.0f) return entry->finalScore;
+	float score = 0.0f;
+	if (node.hasTile(N * N + 1)) {
+		score = 1.0f;
+	}
+	else if (node.hasMoves() || node == GridState<N>()) {
+		auto moves = node.allMoves();
+		for (uint i = 0; i < 4; ++i) {
+			if (moves.moved(i)) score = std::max(score, interScore(toKey(moves.children[i])));
+		}
+	}
+	store(node, score, -1.0f);
+	return score;
 }
 
+// The expected final score after a spawn, each spawn raising the tile sum
 template<uint N>
-std::pair<float, float> InMemoryTablebase<N>::getNodeScores(const GridState<N>& node) const {
-	return m_nodes.at(node);
+float LazyTablebase<N>::interScore(const GridState<N>& node) const {
+	if (const Entry* entry = lookup(node); entry && entry->interScore != -1.0f) return entry->interScore;
+	float score = 0.0f;
+	if (node.hasTile(N * N + 1)) {
+		score = 1.0f;
+	}
+	else if (node.hasMoves() || node == GridState<N>()) {
+		uint emptyTiles = node.numEmptyTiles();
+		for (uint r = 0; r < N; ++r) {
+			for (uint c = 0; c < N; ++c) {
+				if (!node.isEmpty(r, c)) continue;
+				for (uint i = 0; i < 2; ++i) {
+					GridState<N> child = node;
+					child.writeTile(r, c, i + 1);
+					score += (i ? m_fourChance : (1.0f - m_fourChance)) / emptyTiles * finalScore(toKey(child));
+				}
+			}
+		}
+	}
+	store(node, -1.0f, score);
+	return score;
 }
 
 template<uint N>
-void InMemoryTablebase<N>::pushToEdgeQueue(const GridState<N>& node, int depth) {
-	m_edgeQueue.push_back(std::make_pair(node, depth));
+std::pair<int, int> LazyTablebase<N>::bestMove(const GridState<N>& state) const {
+	auto [node, symmetry] = m_canonicalKeys ? state.canonical() : std::make_pair(state, 0u);
+	float bestScore = 0;
+	int bestDirection = -1;
+	auto moves = node.allMoves();
+	for (uint i = 0; i < 4; ++i) {
+		if (!moves.moved(i)) continue;
+		float score = interScore(toKey(moves.children[i]));
+		if (score > bestScore) {
+			bestScore = score;
+			bestDirection = i;
+		}
+	}
+	return bestDirection < 0 ? std::make_pair(-1, -1) : GridState<N>::untransformMove(MOVE_DIRECTIONS[bestDirection], symmetry);
 }
 
-template<uint N>
-std::pair<GridState<N>, int> InMemoryTablebase<N>::popFromEdgeQueue() {
-	std::pair<GridState<N>, int> firstElement = m_edgeQueue.front();
-	m_edgeQueue.pop_front();
-	return firstElement;
-}
+// Read-only tablebase in a single file that is memory mapped when opened, so opening takes the same time whatever
+// the size of the table and queries read the mapping without parsing or allocating. The file holds a header, the
+// keys of every node sorted by their bytes, an index of every INDEX_STRIDE-th key and the scores of the nodes in key
+// order. The index is in Eytzinger (breadth first) order, so the first steps of a search share a few cache lines
+// and its remaining steps stay within one block of keys.
+template<uint N, class SCORE_T = float>
+class MappedTablebase {
+public:
+	explicit MappedTablebase(const std::string& path);
+	// -1 if the state is not a node
+	float query(const GridState<N>& state) const { return scores(state).first; }
+	std::pair<int, int> bestMove(const GridState<N>& state) const;
+	float fourChance() const { return m_header.fourChance; }
+	bool canonicalKeys() const { return m_header.canonicalKeys; }
+	uint64 numNodes() const { return m_header.numNodes; }
+	// Writes the nodes of any tablebase with a forEachNode, such as InMemoryTablebase or SqliteTablebase
+	template<class TABLEBASE>
+	static void write(const std::string& path, const TABLEBASE& tablebase);
+private:
+	struct Header {
+		char magic[8];
+		uint32 version;
+		uint32 n;
+		uint32 keyBytes;
+		uint32 scoreBytes;
+		uint32 scoreIsFloat;
+		uint32 winTile;
+		uint32 canonicalKeys;
+		float fourChance;
+		uint64 numNodes;
+		uint64 indexStride;
+		// index entries, which are numbered from 1
+		uint64 indexSize;
+		uint64 keysOffset;
+		uint64 indexKeysOffset;
+		uint64 indexBlocksOffset;
+		uint64 scoresOffset;
+	};
+	static constexpr char MAGIC[8] = { '2', '0', '4', '8', 'T', 'B', 'L', 'B' };
+	static constexpr uint32 VERSION = 1;
+	static constexpr uint64 KEY_BYTES = GridState<N>::GRID_DATA_BYTES;
+	// keys per index entry, so that the block of keys a search ends in spans a few cache lines
+	static constexpr uint64 INDEX_STRIDE = std::max<uint64>(256 / KEY_BYTES, 1);
+	// sections of the file start on cache line boundaries
+	static constexpr uint64 ALIGNMENT = 64;
+	static uint64 align(uint64 offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+	using Codec = ScoreCodec<SCORE_T>;
+	// Assigns sorted positions to the Eytzinger subtree rooted at entry, in order
+	static void fillIndex(uint64 entry, uint64 indexSize, uint64& next, std::vector<uint64>& blocks);
+	// Position of key in the sorted keys, numNodes if it is absent
+	uint64 find(const GridState<N>& key) const;
+	std::pair<float, float> scores(const GridState<N>& state) const;
+	const unsigned char* keyAt(uint64 i) const { return m_keys + i * KEY_BYTES; }
+	MappedFile m_file;
+	Header m_header;
+	const unsigned char* m_keys;
+	const unsigned char* m_indexKeys;
+	const uint64* m_indexBlocks;
+	const SCORE_T* m_scores;
+};
 
-template<uint N>
-bool InMemoryTablebase<N>::edgeQueueEmpty() {
-	return m_edgeQueue.empty();
+// Only the header is read here, and the file size checked against it
+template<uint N, class SCORE_T>
+MappedTablebase<N, SCORE_T>::MappedTablebase(const std::string& path) : m_file(path) {
+	if (m_file.size() < sizeof(Header)) throw std::runtime_error(path + " is too small to be a tablebase");
+	std::memcpy(&m_header, m_file.data(), sizeof(Header));
+	if (std::memcmp(m_header.magic, MAGIC, sizeof(MAGIC)) != 0 || m_header.version != VERSION) {
+		throw std::runtime_error(path + " is not a tablebase file of this version");
+	}
+	if (m_header.n != N || m_header.keyBytes != KEY_BYTES || m_header.winTile != N * N + 1) {
+		throw std::runtime_error(path + " is a tablebase for a different board");
+	}
+	if (m_header.scoreBytes != sizeof(SCORE_T) || m_header.scoreIsFloat != std::is_floating_point_v<SCORE_T>) {
+		throw std::runtime_error(path + " stores scores as a different type");
+	}
+	if (m_header.indexStride == 0 || m_header.indexSize != (m_header.numNodes + m_header.indexStride - 1) / m_header.indexStride
+		|| m_header.keysOffset + m_header.numNodes * KEY_BYTES > m_file.size()
+		|| m_header.indexKeysOffset + (m_header.indexSize + 1) * KEY_BYTES > m_file.size()
+		|| m_header.indexBlocksOffset % alignof(uint64) != 0
+		|| m_header.indexBlocksOffset + (m_header.indexSize + 1) * sizeof(uint64) > m_file.size()
+		|| m_header.scoresOffset % alignof(SCORE_T) != 0
+		|| m_header.scoresOffset + 2 * m_header.numNodes * sizeof(SCORE_T) > m_file.size()) {
+		throw std::runtime_error(path + " is truncated or corrupt");
+	}
+	m_keys = m_file.data() + m_header.keysOffset;
+	m_indexKeys = m_file.data() + m_header.indexKeysOffset;
+	m_indexBlocks = reinterpret_cast<const uint64*>(m_file.data() + m_header.indexBlocksOffset);
+	m_scores = reinterpret_cast<const SCORE_T*>(m_file.data() + m_header.scoresOffset);
 }
 
-template<uint N>
-void InMemoryTablebase<N>::addEdge(const GridState<N>& parent, const GridState<N>& child, float weight) {
-	m_edges[parent][child] = weight;
-	m_reverseEdges[child].push_back(parent);
+// Descends the index to the last entry not above key, which starts the only block key can be in, then binary
+// searches that block
+template<uint N, class SCORE_T>
+uint64 MappedTablebase<N, SCORE_T>::find(const GridState<N>& key) const {
+	const void* target = key.gridData();
+	uint64 last = 0;
+	for (uint64 entry = 1; entry <= m_header.indexSize;) {
+		bool notAbove = std::memcmp(m_indexKeys + entry * KEY_BYTES, target, KEY_BYTES) <= 0;
+		last = notAbove ? entry : last;
+		entry = 2 * entry + notAbove;
+	}
+	if (last == 0) return m_header.numNodes;
+	uint64 begin = m_indexBlocks[last] * m_header.indexStride;
+	uint64 end = std::min(begin + m_header.indexStride, m_header.numNodes);
+	while (begin < end) {
+		uint64 middle = begin + (end - begin) / 2;
+		int order = std::memcmp(keyAt(middle), target, KEY_BYTES);
+		if (order == 0) return middle;
+		if (order < 0) begin = middle + 1;
+		else end = middle;
+	}
+	return m_header.numNodes;
 }
 
-template<uint N>
-bool InMemoryTablebase<N>::hasEdge(const GridState<N>& node) const {
-	return m_edges.count(node) == 1;
+template<uint N, class SCORE_T>
+std::pair<float, float> MappedTablebase<N, SCORE_T>::scores(const GridState<N>& state) const {
+	uint64 i = find(m_header.canonicalKeys ? state.canonical().first : state);
+	if (i == m_header.numNodes) return std::make_pair(-1.0f, -1.0f);
+	return std::make_pair(Codec::decode(m_scores[2 * i]), Codec::decode(m_scores[2 * i + 1]));
 }
 
-template<uint N>
-std::vector<GridState<N>> InMemoryTablebase<N>::getEdges(const GridState<N>& node) const {
-	std::vector<GridState<N>> edges;
-	for (const auto& p : m_edges.at(node)) {
-		edges.push_back(p.first);
+template<uint N, class SCORE_T>
+std::pair<int, int> MappedTablebase<N, SCORE_T>::bestMove(const GridState<N>& state) const {
+	auto [node, symmetry] = m_header.canonicalKeys ? state.canonical() : std::make_pair(state, 0u);
+	if (find(node) == m_header.numNodes) return std::make_pair(-1, -1);
+	float bestScore = 0;
+	int bestDirection = -1;
+	auto moves = node.allMoves();
+	for (uint i = 0; i < 4; ++i) {
+		if (!moves.moved(i)) continue;
+		float score = scores(moves.children[i]).second;
+		if (score > bestScore) {
+			bestScore = score;
+			bestDirection = i;
+		}
 	}
-	return edges;
+	return bestDirection < 0 ? std::make_pair(-1, -1) : GridState<N>::untransformMove(MOVE_DIRECTIONS[bestDirection], symmetry);
 }
 
-template<uint N>
-float InMemoryTablebase<N>::getEdgeWeight(const GridState<N>& parent, const GridState<N>& child) const {
-	return m_edges.at(parent).at(child);
+template<uint N, class SCORE_T>
+void MappedTablebase<N, SCORE_T>::fillIndex(uint64 entry, uint64 indexSize, uint64& next, std::vector<uint64>& blocks) {
+	if (entry > indexSize) return;
+	fillIndex(2 * entry, indexSize, next, blocks);
+	blocks[entry] = next++;
+	fillIndex(2 * entry + 1, indexSize, next, blocks);
 }
 
-template<uint N>
-std::vector<GridState<N>> InMemoryTablebase<N>::getParents(const GridState<N>& child) const {
-	std::vector<GridState<N>> parents;
-	auto it = m_reverseEdges.find(child);
-	if (it != m_reverseEdges.end()) {
-		for (const GridState<N>& prevState : it->second) {
-			parents.push_back(prevState);
-		}
+template<uint N, class SCORE_T>
+template<class TABLEBASE>
+void MappedTablebase<N, SCORE_T>::write(const std::string& path, const TABLEBASE& tablebase) {
+	std::vector<std::pair<GridState<N>, std::pair<float, float>>> nodes;
+	tablebase.forEachNode([&nodes](const GridState<N>& node, float finalScore, float interScore) {
+		nodes.emplace_back(node, std::make_pair(finalScore, interScore));
+	});
+	if (nodes.empty()) throw std::logic_error("a tablebase with no nodes has not been generated");
+	std::sort(nodes.begin(), nodes.end(), [](const auto& a, const auto& b) {
+		return std::memcmp(a.first.gridData(), b.first.gridData(), KEY_BYTES) < 0;
+	});
+
+	Header header{};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.n = N;
+	header.keyBytes = KEY_BYTES;
+	header.scoreBytes = sizeof(SCORE_T);
+	header.scoreIsFloat = std::is_floating_point_v<SCORE_T>;
+	header.winTile = N * N + 1;
+	header.canonicalKeys = tablebase.canonicalKeys();
+	header.fourChance = tablebase.fourChance();
+	header.numNodes = nodes.size();
+	header.indexStride = INDEX_STRIDE;
+	header.indexSize = (nodes.size() + INDEX_STRIDE - 1) / INDEX_STRIDE;
+	header.keysOffset = align(sizeof(Header));
+	header.indexKeysOffset = align(header.keysOffset + header.numNodes * KEY_BYTES);
+	header.indexBlocksOffset = align(header.indexKeysOffset + (header.indexSize + 1) * KEY_BYTES);
+	header.scoresOffset = align(header.indexBlocksOffset + (header.indexSize + 1) * sizeof(uint64));
+
+	std::vector<uint64> blocks(header.indexSize + 1, 0);
+	uint64 next = 0;
+	fillIndex(1, header.indexSize, next, blocks);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	auto padTo = [&file](uint64 offset) {
+		static constexpr char zeros[ALIGNMENT] = {};
+		file.write(zeros, offset - uint64(file.tellp()));
+	};
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	padTo(header.keysOffset);
+	for (const auto& [node, scores] : nodes) file.write(static_cast<const char*>(node.gridData()), KEY_BYTES);
+	padTo(header.indexKeysOffset);
+	// entry 0 is unused
+	file.write(static_cast<const char*>(nodes.front().first.gridData()), KEY_BYTES);
+	for (uint64 entry = 1; entry <= header.indexSize; ++entry) {
+		file.write(static_cast<const char*>(nodes[blocks[entry] * INDEX_STRIDE].first.gridData()), KEY_BYTES);
 	}
-	return parents;
+	padTo(header.indexBlocksOffset);
+	file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * sizeof(uint64));
+	padTo(header.scoresOffset);
+	for (const auto& [node, scores] : nodes) {
+		SCORE_T stored[2] = { Codec::encode(scores.first), Codec::encode(scores.second) };
+		file.write(reinterpret_cast<const char*>(stored), sizeof(stored));
+	}
+	if (!file) throw std::runtime_error("failed to write " + path);
 }
 
-template<uint N>
-void InMemoryTablebase<N>::copyNodesToScoreQueue() {
-	for (const auto &p : m_nodes) {
-		const GridState<N>& state = p.first;
-		m_scoreQueue.push_front(state);
+// Read-only tablebase in a compressed file, for shipping and storing finished tablebases. Nodes are sorted by key
+// and split into blocks of BLOCK_NODES. A block holds the difference of each key after the first from the one
+// before it as a varint, then the scores of its nodes as SCORE_T. The first key and file offset of every block
+// make up a sparse index that is kept uncompressed at the end of the file, so a lookup binary searches the index
+// and decodes a single block. Keys are compared as little endian integers of up to 128 bits, which covers boards up
+// to 4x4, and keys of at most 64 bits are stored in 64 bit index entries.
+template<uint N, class SCORE_T = float>
+class ArchiveTablebase {
+public:
+	explicit ArchiveTablebase(const std::string& path);
+	// -1 if the state is not a node
+	float query(const GridState<N>& state) const { return scores(state).first; }
+	std::pair<int, int> bestMove(const GridState<N>& state) const;
+	float fourChance() const { return m_header.fourChance; }
+	bool canonicalKeys() const { return m_header.canonicalKeys; }
+	uint64 numNodes() const { return m_header.numNodes; }
+	// Compresses the nodes of a tablebase that has a forEachNode
+	template<class TABLEBASE>
+	static void write(const std::string& path, const TABLEBASE& tablebase);
+private:
+	struct Header {
+		char magic[8];
+		uint32 version;
+		uint32 n;
+		uint32 keyBytes;
+		uint32 scoreBytes;
+		uint32 scoreIsFloat;
+		uint32 winTile;
+		uint32 canonicalKeys;
+		float fourChance;
+		uint64 numNodes;
+		uint64 blockNodes;
+		uint64 numBlocks;
+		uint64 indexOffset;
+	};
+	// Unsigned 128 bit integer with only the operations keys need, since not every compiler has one
+	struct WideKey {
+		uint64 high = 0;
+		uint64 low = 0;
+		WideKey() = default;
+		WideKey(uint64 value) : low(value) {}
+		explicit operator uint64() const { return low; }
+		auto operator<=>(const WideKey&) const = default;
+		WideKey operator~() const { return from(~high, ~low); }
+		WideKey operator|(const WideKey& o) const { return from(high | o.high, low | o.low); }
+		WideKey operator+(const WideKey& o) const { return from(high + o.high + (low + o.low < low), low + o.low); }
+		WideKey operator-(const WideKey& o) const { return from(high - o.high - (low < o.low), low - o.low); }
+		WideKey operator<<(uint shift) const {
+			if (shift == 0) return *this;
+			return shift < 64 ? from((high << shift) | (low >> (64 - shift)), low << shift) : from(low << (shift - 64), 0);
+		}
+		WideKey operator>>(uint shift) const {
+			if (shift == 0) return *this;
+			return shift < 64 ? from(high >> shift, (low >> shift) | (high << (64 - shift))) : from(0, high >> (shift - 64));
+		}
+		WideKey& operator|=(const WideKey& o) { return *this = *this | o; }
+		WideKey& operator+=(const WideKey& o) { return *this = *this + o; }
+		WideKey& operator>>=(uint shift) { return *this = *this >> shift; }
+		static WideKey from(uint64 high, uint64 low) { WideKey key; key.high = high; key.low = low; return key; }
+	};
+	static constexpr uint64 KEY_BYTES = GridState<N>::GRID_DATA_BYTES;
+	static_assert(KEY_BYTES <= 2 * sizeof(uint64), "archive keys must fit in 128 bits");
+	using Key = std::conditional_t<KEY_BYTES <= sizeof(uint64), uint64, WideKey>;
+	// block numBlocks only marks the end of the last block
+	struct IndexEntry {
+		Key firstKey;
+		uint64 offset;
+	};
+	static constexpr char MAGIC[8] = { '2', '0', '4', '8', 'T', 'B', 'A', 'R' };
+	static constexpr uint32 VERSION = 1;
+	static constexpr uint64 BLOCK_NODES = 128;
+	using Codec = ScoreCodec<SCORE_T>;
+	static Key keyOf(const GridState<N>& node);
+	static void writeVarint(std::ostream& o, Key value);
+	static Key readVarint(const unsigned char*& p);
+	// Position of the key in its block and a pointer to the block's scores, or a null pointer if it is absent
+	std::pair<uint64, const unsigned char*> find(const GridState<N>& node) const;
+	std::pair<float, float> scores(const GridState<N>& state) const;
+	MappedFile m_file;
+	Header m_header;
+	const IndexEntry* m_index;
+};
+
+template<uint N, class SCORE_T>
+ArchiveTablebase<N, SCORE_T>::ArchiveTablebase(const std::string& path) : m_file(path) {
+	if (m_file.size() < sizeof(Header)) throw std::runtime_error(path + " is too small to be a tablebase");
+	std::memcpy(&m_header, m_file.data(), sizeof(Header));
+	if (std::memcmp(m_header.magic, MAGIC, sizeof(MAGIC)) != 0 || m_header.version != VERSION) {
+		throw std::runtime_error(path + " is not a tablebase archive of this version");
+	}
+	if (m_header.n != N || m_header.keyBytes != KEY_BYTES || m_header.winTile != N * N + 1) {
+		throw std::runtime_error(path + " is a tablebase for a different board");
 	}
+	if (m_header.scoreBytes != sizeof(SCORE_T) || m_header.scoreIsFloat != std::is_floating_point_v<SCORE_T>) {
+		throw std::runtime_error(path + " stores scores as a different type");
+	}
+	if (m_header.blockNodes == 0 || m_header.numBlocks != (m_header.numNodes + m_header.blockNodes - 1) / m_header.blockNodes
+		|| m_header.indexOffset % alignof(IndexEntry) != 0
+		|| m_header.indexOffset + (m_header.numBlocks + 1) * sizeof(IndexEntry) > m_file.size()) {
+		throw std::runtime_error(path + " is truncated or corrupt");
+	}
+	m_index = reinterpret_cast<const IndexEntry*>(m_file.data() + m_header.indexOffset);
 }
 
-template<uint N>
-void InMemoryTablebase<N>::pushToScoreQueue(const GridState<N>& node) {
-	m_scoreQueue.push_back(node);
+template<uint N, class SCORE_T>
+typename ArchiveTablebase<N, SCORE_T>::Key ArchiveTablebase<N, SCORE_T>::keyOf(const GridState<N>& node) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(node.gridData());
+	Key key = 0;
+	for (uint64 i = 0; i < KEY_BYTES; ++i) key |= Key(bytes[i]) << (8 * i);
+	return key;
 }
 
-template<uint N>
-GridState<N> InMemoryTablebase<N>::popFromScoreQueue() {
-	GridState<N> firstElement = m_scoreQueue.front();
-	m_scoreQueue.pop_front();
-	return firstElement;
+// 7 bits per byte, least significant first, with the high bit set on every byte but the last
+template<uint N, class SCORE_T>
+void ArchiveTablebase<N, SCORE_T>::writeVarint(std::ostream& o, Key value) {
+	for (; value >= Key(0x80); value >>= 7) o.put(char(uint64(value) | 0x80));
+	o.put(char(uint64(value)));
 }
 
-template<uint N>
-bool InMemoryTablebase<N>::scoreQueueEmpty() const {
-	return m_scoreQueue.empty();
+template<uint N, class SCORE_T>
+typename ArchiveTablebase<N, SCORE_T>::Key ArchiveTablebase<N, SCORE_T>::readVarint(const unsigned char*& p) {
+	Key value = 0;
+	for (uint shift = 0;; shift += 7) {
+		unsigned char byte = *p++;
+		value |= Key(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) return value;
+	}
 }
 
-template<uint N>
-void InMemoryTablebase<N>::addInterScore(const GridState<N>& node, float score) {
-	m_nodes[node].second = score;
+template<uint N, class SCORE_T>
+std::pair<uint64, const unsigned char*> ArchiveTablebase<N, SCORE_T>::find(const GridState<N>& node) const {
+	Key key = keyOf(node);
+	const IndexEntry* end = m_index + m_header.numBlocks;
+	const IndexEntry* block = std::upper_bound(m_index, end, key, [](Key k, const IndexEntry& entry) { return k < entry.firstKey; });
+	if (block == m_index) return std::make_pair(0, nullptr);
+	--block;
+	uint64 blockSize = std::min(m_header.blockNodes, m_header.numNodes - uint64(block - m_index) * m_header.blockNodes);
+	const unsigned char* blockEnd = m_file.data() + block[1].offset;
+	const unsigned char* scores = blockEnd - 2 * blockSize * sizeof(SCORE_T);
+	const unsigned char* p = m_file.data() + block->offset;
+	Key current = block->firstKey;
+	for (uint64 i = 0; current <= key; current += readVarint(p)) {
+		if (current == key) return std::make_pair(i, scores);
+		if (++i == blockSize) break;
+	}
+	return std::make_pair(0, nullptr);
 }
 
-template<uint N>
-void InMemoryTablebase<N>::addNonInterScore(const GridState<N>& node, float score) {
-	m_nodes[node].first = score;
+template<uint N, class SCORE_T>
+std::pair<float, float> ArchiveTablebase<N, SCORE_T>::scores(const GridState<N>& state) const {
+	auto [i, scores] = find(m_header.canonicalKeys ? state.canonical().first : state);
+	if (!scores) return std::make_pair(-1.0f, -1.0f);
+	SCORE_T stored[2];
+	std::memcpy(stored, scores + 2 * i * sizeof(SCORE_T), sizeof(stored));
+	return std::make_pair(Codec::decode(stored[0]), Codec::decode(stored[1]));
 }
 
-template<uint N>
-void InMemoryTablebase<N>::dump(std::ostream &o) const {
-	GridState<N> state;
-	for(;;) {
-		state.printCompact(o);
-		o << ": ";
-		if(m_nodes.count(state)) {
-			o << m_nodes.at(state).first << "," << m_nodes.at(state).second;
-		} else {
-			o << "-1,-1";
+template<uint N, class SCORE_T>
+std::pair<int, int> ArchiveTablebase<N, SCORE_T>::bestMove(const GridState<N>& state) const {
+	auto [node, symmetry] = m_header.canonicalKeys ? state.canonical() : std::make_pair(state, 0u);
+	if (!find(node).second) return std::make_pair(-1, -1);
+	float bestScore = 0;
+	int bestDirection = -1;
+	auto moves = node.allMoves();
+	for (uint i = 0; i < 4; ++i) {
+		if (!moves.moved(i)) continue;
+		float score = scores(moves.children[i]).second;
+		if (score > bestScore) {
+			bestScore = score;
+			bestDirection = i;
 		}
-		o << std::endl;
+	}
+	return bestDirection < 0 ? std::make_pair(-1, -1) : GridState<N>::untransformMove(MOVE_DIRECTIONS[bestDirection], symmetry);
+}
 
-		for(uint i = 0;; ++i) {
-			if(i == N*N) return;
-			uint tile = state.readTile(i/N, i%N) + 1;
-			if(tile == N*N+2) {
-				state.writeTile(i/N, i%N, 0);
-			}
-			else {
-				state.writeTile(i/N, i%N, tile);
-				break;
-			}
+// The header is written last, once the offset of the index is known
+template<uint N, class SCORE_T>
+template<class TABLEBASE>
+void ArchiveTablebase<N, SCORE_T>::write(const std::string& path, const TABLEBASE& tablebase) {
+	std::vector<std::pair<Key, std::pair<float, float>>> nodes;
+	tablebase.forEachNode([&nodes](const GridState<N>& node, float finalScore, float interScore) {
+		nodes.emplace_back(keyOf(node), std::make_pair(finalScore, interScore));
+	});
+	std::sort(nodes.begin(), nodes.end());
+
+	Header header{};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.n = N;
+	header.keyBytes = KEY_BYTES;
+	header.scoreBytes = sizeof(SCORE_T);
+	header.scoreIsFloat = std::is_floating_point_v<SCORE_T>;
+	header.winTile = N * N + 1;
+	header.canonicalKeys = tablebase.canonicalKeys();
+	header.fourChance = tablebase.fourChance();
+	header.numNodes = nodes.size();
+	header.blockNodes = BLOCK_NODES;
+	header.numBlocks = (nodes.size() + BLOCK_NODES - 1) / BLOCK_NODES;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	std::vector<IndexEntry> index;
+	for (uint64 begin = 0; begin < nodes.size(); begin += BLOCK_NODES) {
+		uint64 end = std::min<uint64>(begin + BLOCK_NODES, nodes.size());
+		index.push_back(IndexEntry{ nodes[begin].first, uint64(file.tellp()) });
+		for (uint64 i = begin + 1; i < end; ++i) writeVarint(file, nodes[i].first - nodes[i - 1].first);
+		for (uint64 i = begin; i < end; ++i) {
+			SCORE_T stored[2] = { Codec::encode(nodes[i].second.first), Codec::encode(nodes[i].second.second) };
+			file.write(reinterpret_cast<const char*>(stored), sizeof(stored));
 		}
 	}
+	index.push_back(IndexEntry{ ~Key(0), uint64(file.tellp()) });
+	while (file.tellp() % alignof(IndexEntry) != 0) file.put(0);
+	header.indexOffset = file.tellp();
+	file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(IndexEntry));
+	file.seekp(0);
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!file) throw std::runtime_error("failed to write " + path);
 }
 
 template<uint N>
-class SqliteTablebase : public ITablebase<N> {
+class SqliteTablebase : public TablebaseCore<N, SqliteTablebase<N>> {
+	using Core = TablebaseCore<N, SqliteTablebase<N>>;
+	friend Core;
 public:
-	SqliteTablebase(float fourChance, const std::string& dbName = "", int cacheSize = -16777216 /*16GiB*/);
+	SqliteTablebase(float fourChance, const std::string& dbName = "", int cacheSize = -16777216 /*16GiB*/, bool canonicalKeys = false);
 	virtual ~SqliteTablebase();
 	virtual float query(const GridState<N>& state) const override;
-	virtual void generateEdges(uint64 maxActions, int maxDepth) override { beginTransaction(); ITablebase<N>::generateEdges(maxActions, maxDepth); commitTransaction(); }
-	virtual void calculateScores(uint64 maxActions) override { beginTransaction(); ITablebase<N>::calculateScores(maxActions); commitTransaction(); }
+	void generateEdges(uint64 maxActions, int maxDepth);
+	void calculateScores(uint64 maxActions);
+	// Makes generateEdges keep new nodes and edges in memory and write them a few hundred rows per statement,
+	// instead of running an insert for every row
+	void setBulkWrites(bool enabled) { m_bulkWrites = enabled; }
+	// Totals over every write of staged rows
+	struct FlushStats {
+		uint64 flushes = 0;
+		uint64 rows = 0;
+		double seconds = 0;
+		double rowsPerSecond() const { return seconds > 0 ? rows / seconds : 0; }
+	};
+	const FlushStats& flushStats() const { return m_flushStats; }
+	// Calls f(node, final score, intermediate score) for every node
+	template<class F>
+	void forEachNode(F&& f) const;
 protected:
-	virtual void initializeEdgeQueue() override;
-	virtual void setNode(const GridState<N>& node, float noninterScore = -1, float interScore = -1) override;
-	virtual bool hasNode(const GridState<N>& node) const override;
-	virtual std::pair<float, float> getNodeScores(const GridState<N>& node) const override;
-	virtual void pushToEdgeQueue(const GridState<N>& node, int depth) override;
-	virtual std::pair<GridState<N>, int> popFromEdgeQueue() override;
-	virtual bool edgeQueueEmpty() override;
-	virtual void addEdge(const GridState<N>& parent, const GridState<N>& child, float weight) override;
-	virtual bool hasEdge(const GridState<N>& node) const override;
-	virtual std::vector<GridState<N>> getEdges(const GridState<N>& node) const override;
-	virtual float getEdgeWeight(const GridState<N>& parent, const GridState<N>& child) const override;
-	virtual std::vector<GridState<N>> getParents(const GridState<N>& child) const override;
-	virtual void copyNodesToScoreQueue() override;
-	virtual void pushToScoreQueue(const GridState<N>& node) override;
-	virtual GridState<N> popFromScoreQueue() override;
-	virtual bool scoreQueueEmpty() const override;
-	virtual void addInterScore(const GridState<N>& node, float score) override;
-	virtual void addNonInterScore(const GridState<N>& node, float score) override;
+	void initializeEdgeQueue();
+	void setNode(const GridState<N>& node, float noninterScore = -1, float interScore = -1);
+	bool hasNode(const GridState<N>& node) const;
+	std::pair<float, float> getNodeScores(const GridState<N>& node) const;
+	void pushToEdgeQueue(const GridState<N>& node, int depth);
+	std::pair<GridState<N>, int> popFromEdgeQueue();
+	bool edgeQueueEmpty();
+	void addEdge(const GridState<N>& parent, const GridState<N>& child, float weight);
+	bool hasEdge(const GridState<N>& node) const;
+	void getChildEdges(const GridState<N>& node, std::vector<typename Core::Edge>& edges) const;
+	void getParentEdges(const GridState<N>& child, std::vector<typename Core::Edge>& edges) const;
+	void copyNodesToScoreQueue();
+	void pushToScoreQueue(const GridState<N>& node);
+	GridState<N> popFromScoreQueue();
+	bool scoreQueueEmpty() const;
+	void addInterScore(const GridState<N>& node, float score);
+	void addNonInterScore(const GridState<N>& node, float score);
 private:
 	void beginTransaction() {
 		CHECK_RETURN_CODE(sqlite3_step(m_psBegin), SQLITE_DONE);
@@ -487,31 +2513,89 @@ private:
 		CHECK_RETURN_CODE(sqlite3_reset(m_psCommit), SQLITE_OK);
 	}
 
+	// Grids as every database was written before grid_layout_version was recorded, which is also the layout of
+	// GridState<N> for boards that fit in one word
+	using LegacyGrid = GridState<N, packed_bitset<tileLog2(N*N + 1) * N * N>>;
+	static constexpr bool LEGACY_LAYOUT_DIFFERS = LegacyGrid::GRID_DATA_BYTES != GridState<N>::GRID_DATA_BYTES;
+	// Copies every tile of a grid into a grid with another layout
+	template<class TO, class FROM>
+	static TO convertGrid(const FROM& grid);
+	// Reads a grid from a blob column in the layout of the database
+	void readGrid(sqlite3_stmt* statement, int column, GridState<N>& grid) const;
+	// Binds a grid to a blob parameter in the layout of the database
+	void bindGrid(sqlite3_stmt* statement, int param, const GridState<N>& grid) const;
+	// Runs an edge query bound to state, replacing edges with its rows
+	void readEdges(sqlite3_stmt* statement, const GridState<N>& state, std::vector<typename Core::Edge>& edges) const;
+	// Writes every staged row
+	void flushStaged();
+	void flushIfFull() { if (m_stagedNodes.size() + m_stagedEdges.size() >= BULK_FLUSH_ROWS) flushStaged(); }
+	// The file the database is in, which the queue files are named after
+	static std::string databasePath(float fourChance, const std::string& dbName);
+	// Checkpoints queue and records its cursor in the config table under name
+	template<class T>
+	void saveQueue(SpillQueue<T>& queue, const char* name);
+	// Restores queue from the cursor recorded under name, if there is one
+	template<class T>
+	void loadQueue(SpillQueue<T>& queue, const char* name);
+	// Moves the rows of a queue table from before the queues were kept in files into queue and drops the table.
+	// readRow(statement) returns the item of the current row of selectSql.
+	template<class T, class F>
+	void migrateQueueTable(const char* selectSql, const char* dropSql, SpillQueue<T>& queue, const char* name, F&& readRow);
+	// Inserts count rows, BULK_INSERT_ROWS per step of bulkStatement and the rest one per step of rowStatement.
+	// bindRow(statement, index of the row's first parameter, row) binds the columns of one row.
+	template<class F>
+	void insertRows(sqlite3_stmt* bulkStatement, sqlite3_stmt* rowStatement, uint columns, uint64 count, F&& bindRow);
+	// A statement inserting BULK_INSERT_ROWS rows of values
+	static std::string bulkInsertSql(const char* insert, const char* values);
+
+	// rows inserted by one step of a bulk insert statement, which stays well below SQLite's limit of parameters
+	static constexpr uint BULK_INSERT_ROWS = 256;
+	// items of each queue kept in memory before older items are written to its file
+	static constexpr uint64 QUEUE_MEMORY_ITEMS = 1 << 22;
+	// staged rows that make generateEdges write them before it continues
+	static constexpr uint64 BULK_FLUSH_ROWS = 1 << 18;
+	bool m_bulkWrites = false;
+	FlushStats m_flushStats;
+	// set while generateEdges is staging rows
+	bool m_staging = false;
+	// new nodes with their final and intermediate scores, in the order they were added
+	ankerl::unordered_dense::map<GridState<N>, std::pair<float, float>> m_stagedNodes;
+	std::vector<std::tuple<GridState<N>, GridState<N>, float>> m_stagedEdges;
+
+	struct QueuedState {
+		GridState<N> node;
+		int depth;
+	};
+	// The queues are kept next to the database in <database>.edge_queue and <database>.score_queue. Their cursors
+	// are recorded in the config table in the transaction that ends each generateEdges and calculateScores call.
+	SpillQueue<QueuedState> m_edgeQueue;
+	SpillQueue<GridState<N>> m_scoreQueue;
+
 	sqlite3* m_db;
 
 	sqlite3_stmt* m_psBegin;
 	sqlite3_stmt* m_psCommit;
 
 	sqlite3_stmt* m_psInsertNode;
+	sqlite3_stmt* m_psBulkInsertNode;
 	sqlite3_stmt* m_psUpdateNodeInter;
 	sqlite3_stmt* m_psUpdateNodeNoninter;
 	sqlite3_stmt* m_psQueryNodeScores;
 	sqlite3_stmt* m_psQueryNodeExists;
 
 	sqlite3_stmt* m_psInsertEdge;
-	sqlite3_stmt* m_psQueryEdge;
+	sqlite3_stmt* m_psBulkInsertEdge;
 	sqlite3_stmt* m_psQueryEdges;
-	sqlite3_stmt* m_psQueryReverseEdges;
-
-	sqlite3_stmt* m_psEdgeQueueGetFront;
-	sqlite3_stmt* m_psEdgeQueuePopFront;
-	sqlite3_stmt* m_psEdgeQueuePushBack;
+	sqlite3_stmt* m_psQueryChildEdges;
+	sqlite3_stmt* m_psQueryParentEdges;
 
-	sqlite3_stmt* m_psScoreQueueGetFront;
-	sqlite3_stmt* m_psScoreQueuePopFront;
-	sqlite3_stmt* m_psScoreQueuePushBack;
 	sqlite3_stmt* m_psCopyNodesToScoreQueue;
 
+	// 1 for grids stored as LegacyGrid, 2 for grids stored as GridState<N>
+	static constexpr uint GRID_LAYOUT_VERSION = 2;
+	// set if the database stores LegacyGrid and that differs from GridState<N>
+	bool m_legacyLayout = false;
+
 	static constexpr char PRAGMA_SYNCHRONOUS_SQL[] = "PRAGMA synchronous = OFF;";
 	static constexpr char PRAGMA_JOURNAL_SQL[] = "PRAGMA journal_mode = MEMORY;";
 	static constexpr char BEGIN_SQL[] = "BEGIN;";
@@ -529,17 +2613,6 @@ private:
 		"PRIMARY KEY(start_state, end_state)\n"
 		") STRICT;";
 
-	static constexpr char CREATE_TABLE_EDGE_QUEUE_SQL[] = "CREATE TABLE IF NOT EXISTS edge_queue(\n"
-		"id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
-		"node BLOB NOT NULL,\n"
-		"node_depth INTEGER NOT NULL\n"
-		") STRICT;";
-
-	static constexpr char CREATE_TABLE_SCORE_QUEUE_SQL[] = "CREATE TABLE IF NOT EXISTS score_queue (\n"
-		"id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
-		"node BLOB NOT NULL\n"
-		") STRICT;";
-
 	static constexpr char CREATE_TABLE_CONFIG_SQL[] = "CREATE TABLE IF NOT EXISTS config(\n"
 		"prop_name TEXT PRIMARY KEY,\n"
 		"prop_value TEXT\n"
@@ -548,40 +2621,48 @@ private:
 	static constexpr char CREATE_INDEX_REVERSE_EDGE_SQL[] = "CREATE INDEX IF NOT EXISTS reverse_edge ON edge(end_state);";
 
 	static constexpr char INSERT_NODE_SQL[] = "INSERT INTO node(grid_state, inter_score, noninter_score) VALUES (?, ?, ?);";
+	static constexpr char BULK_INSERT_NODE_SQL[] = "INSERT INTO node(grid_state, inter_score, noninter_score) VALUES ";
 	static constexpr char UPDATE_NODE_INTER_SQL[] = "UPDATE node SET inter_score = ? WHERE grid_state = ?;";
 	static constexpr char UPDATE_NODE_NONINTER_SQL[] = "UPDATE node SET noninter_score = ? WHERE grid_state = ?;";
 	static constexpr char QUERY_NODE_SCORES_SQL[] = "SELECT inter_score, noninter_score FROM node WHERE grid_state = ?;";
 	static constexpr char QUERY_NODE_EXISTS_SQL[] = "SELECT count(*) FROM node WHERE grid_state = ?;";
+	static constexpr char QUERY_ALL_NODES_SQL[] = "SELECT grid_state, noninter_score, inter_score FROM node;";
 
 	static constexpr char INSERT_EDGE_SQL[] = "INSERT INTO edge(start_state, end_state, weight) VALUES(?, ?, ?);";
-	static constexpr char QUERY_EDGE_SQL[] = "SELECT weight FROM edge WHERE start_state = ? AND end_state = ?;";
+	static constexpr char BULK_INSERT_EDGE_SQL[] = "INSERT INTO edge(start_state, end_state, weight) VALUES ";
 	static constexpr char QUERY_EDGES_SQL[] = "SELECT end_state FROM edge WHERE start_state = ?;";
-	static constexpr char QUERY_REVERSE_EDGES_SQL[] = "SELECT start_state FROM edge WHERE end_state = ?;";
+	static constexpr char QUERY_CHILD_EDGES_SQL[] = "SELECT edge.end_state, edge.weight, node.noninter_score, node.inter_score FROM edge LEFT JOIN node ON node.grid_state = edge.end_state WHERE edge.start_state = ?;";
+	static constexpr char QUERY_PARENT_EDGES_SQL[] = "SELECT edge.start_state, edge.weight, node.noninter_score, node.inter_score FROM edge LEFT JOIN node ON node.grid_state = edge.start_state WHERE edge.end_state = ?;";
 
 	static constexpr char EDGE_QUEUE_INIT_SQL[] = "INSERT INTO config(prop_name, prop_value) VALUES ('edge_queue_init','TRUE');";
 	static constexpr char EDGE_QUEUE_IS_INIT_SQL[] = "SELECT 1 FROM config WHERE prop_name = 'edge_queue_init';";
-	static constexpr char EDGE_QUEUE_GET_FRONT_SQL[] = "SELECT node, node_depth from edge_queue WHERE id = (SELECT min(id) FROM edge_queue);";
-	static constexpr char EDGE_QUEUE_POP_FRONT_SQL[] = "DELETE from edge_queue WHERE id = (SELECT min(id) FROM edge_queue);";
-	static constexpr char EDGE_QUEUE_PUSH_BACK_SQL[] = "INSERT INTO edge_queue(node, node_depth) VALUES(?,?);";
+	static constexpr char EDGE_QUEUE_CURSOR[] = "edge_queue_cursor";
+	static constexpr char LEGACY_EDGE_QUEUE_SQL[] = "SELECT node, node_depth FROM edge_queue ORDER BY id;";
+	static constexpr char DROP_LEGACY_EDGE_QUEUE_SQL[] = "DROP TABLE edge_queue;";
+
+	static constexpr char GRID_LAYOUT_INIT_SQL[] = "INSERT INTO config(prop_name, prop_value) VALUES ('grid_layout_version', ?);";
+	static constexpr char GRID_LAYOUT_QUERY_SQL[] = "SELECT prop_value FROM config WHERE prop_name = 'grid_layout_version';";
 
-	static constexpr char SCORE_QUEUE_INIT_SQL[] = "INSERT INTO config(prop_name, prop_value) VALUES ('score_queue_init','TRUE');";
+	static constexpr char CANONICAL_KEYS_INIT_SQL[] = "INSERT INTO config(prop_name, prop_value) VALUES ('canonical_keys', ?);";
+	static constexpr char CANONICAL_KEYS_QUERY_SQL[] = "SELECT prop_value FROM config WHERE prop_name = 'canonical_keys';";
+
+	static constexpr char SCORE_QUEUE_INIT_SQL[] = "INSERT OR REPLACE INTO config(prop_name, prop_value) VALUES ('score_queue_init','TRUE');";
 	static constexpr char SCORE_QUEUE_IS_INIT_SQL[] = "SELECT 1 FROM config WHERE prop_name = 'score_queue_init';";
-	static constexpr char SCORE_QUEUE_GET_FRONT_SQL[] = "SELECT node from score_queue WHERE id = (SELECT min(id) FROM score_queue);";
-	static constexpr char SCORE_QUEUE_POP_FRONT_SQL[] = "DELETE from score_queue WHERE id = (SELECT min(id) FROM score_queue);";
-	static constexpr char SCORE_QUEUE_PUSH_BACK_SQL[] = "INSERT INTO score_queue(node) VALUES(?);";
-	static constexpr char COPY_NODES_TO_SCORE_QUEUE_SQL[] = "INSERT INTO score_queue(node) SELECT grid_state FROM node ORDER BY rowid DESC;";
+	static constexpr char SCORE_QUEUE_CURSOR[] = "score_queue_cursor";
+	static constexpr char LEGACY_SCORE_QUEUE_SQL[] = "SELECT node FROM score_queue ORDER BY id;";
+	static constexpr char DROP_LEGACY_SCORE_QUEUE_SQL[] = "DROP TABLE score_queue;";
+	static constexpr char COPY_NODES_TO_SCORE_QUEUE_SQL[] = "SELECT grid_state FROM node ORDER BY rowid DESC;";
+
+	static constexpr char QUEUE_CURSOR_QUERY_SQL[] = "SELECT prop_value FROM config WHERE prop_name = ?;";
+	static constexpr char QUEUE_CURSOR_SAVE_SQL[] = "INSERT OR REPLACE INTO config(prop_name, prop_value) VALUES (?, ?);";
 };
 
 template<uint N>
-SqliteTablebase<N>::SqliteTablebase(float fourChance, const std::string& dbName, int cacheSize) : ITablebase<N>(fourChance) {
-	if (dbName.empty()) {
-		std::ostringstream dbNameStr;
-		dbNameStr << "2048_tb_" << N << '-' << fourChance << ".sqlite";
-		CHECK_RETURN_CODE(sqlite3_open(dbNameStr.str().c_str(), &m_db), SQLITE_OK);
-	}
-	else {
-		CHECK_RETURN_CODE(sqlite3_open(dbName.c_str(), &m_db), SQLITE_OK);
-	}
+SqliteTablebase<N>::SqliteTablebase(float fourChance, const std::string& dbName, int cacheSize, bool canonicalKeys) :
+	Core(fourChance, canonicalKeys),
+	m_edgeQueue(databasePath(fourChance, dbName) + ".edge_queue", QUEUE_MEMORY_ITEMS),
+	m_scoreQueue(databasePath(fourChance, dbName) + ".score_queue", QUEUE_MEMORY_ITEMS) {
+	CHECK_RETURN_CODE(sqlite3_open(databasePath(fourChance, dbName).c_str(), &m_db), SQLITE_OK);
 
 	CHECK_RETURN_CODE(sqlite3_exec(m_db, PRAGMA_SYNCHRONOUS_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_exec(m_db, PRAGMA_JOURNAL_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
@@ -591,44 +2672,97 @@ SqliteTablebase<N>::SqliteTablebase(float fourChance, const std::string& dbName,
 
 	CHECK_RETURN_CODE(sqlite3_exec(m_db, CREATE_TABLE_NODE_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_exec(m_db, CREATE_TABLE_EDGE_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_exec(m_db, CREATE_TABLE_EDGE_QUEUE_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_exec(m_db, CREATE_TABLE_SCORE_QUEUE_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_exec(m_db, CREATE_TABLE_CONFIG_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_exec(m_db, CREATE_INDEX_REVERSE_EDGE_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
+
+	// Nodes are either all canonical or all as generated, so the mode can't change once generation started.
+	// Tablebases generated before the mode was recorded don't use canonical keys.
+	sqlite3_stmt* psCanonicalKeys;
+	CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, CANONICAL_KEYS_QUERY_SQL, -1, &psCanonicalKeys, nullptr), SQLITE_OK);
+	int returnCode = sqlite3_step(psCanonicalKeys);
+	bool storedCanonicalKeys;
+	bool recorded = (returnCode == SQLITE_ROW);
+	if (recorded) {
+		storedCanonicalKeys = std::string(reinterpret_cast<const char*>(sqlite3_column_text(psCanonicalKeys, 0))) == "TRUE";
+	}
+	else {
+		CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
+		sqlite3_stmt* psEdgeQueueIsInit;
+		CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, EDGE_QUEUE_IS_INIT_SQL, -1, &psEdgeQueueIsInit, nullptr), SQLITE_OK);
+		int edgeQueueReturnCode = sqlite3_step(psEdgeQueueIsInit);
+		if (edgeQueueReturnCode != SQLITE_ROW) CHECK_RETURN_CODE(edgeQueueReturnCode, SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_finalize(psEdgeQueueIsInit), SQLITE_OK);
+		storedCanonicalKeys = (edgeQueueReturnCode == SQLITE_ROW) ? false : canonicalKeys;
+	}
+	CHECK_RETURN_CODE(sqlite3_reset(psCanonicalKeys), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_finalize(psCanonicalKeys), SQLITE_OK);
+	if (storedCanonicalKeys != canonicalKeys) {
+		sqlite3_close(m_db);
+		throw std::runtime_error(canonicalKeys ? "tablebase was generated without canonical keys" : "tablebase was generated with canonical keys");
+	}
+	if (!recorded) {
+		CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, CANONICAL_KEYS_INIT_SQL, -1, &psCanonicalKeys, nullptr), SQLITE_OK);
+		CHECK_RETURN_CODE(sqlite3_bind_text(psCanonicalKeys, 1, canonicalKeys ? "TRUE" : "FALSE", -1, SQLITE_STATIC), SQLITE_OK);
+		CHECK_RETURN_CODE(sqlite3_step(psCanonicalKeys), SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_finalize(psCanonicalKeys), SQLITE_OK);
+	}
+
+	// Tablebases generated before the grid layout was recorded store every grid as LegacyGrid
+	sqlite3_stmt* psGridLayout;
+	CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, GRID_LAYOUT_QUERY_SQL, -1, &psGridLayout, nullptr), SQLITE_OK);
+	returnCode = sqlite3_step(psGridLayout);
+	uint gridLayoutVersion = GRID_LAYOUT_VERSION;
+	if (returnCode == SQLITE_ROW) {
+		gridLayoutVersion = uint(sqlite3_column_int(psGridLayout, 0));
+		CHECK_RETURN_CODE(sqlite3_finalize(psGridLayout), SQLITE_OK);
+	}
+	else {
+		CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_finalize(psGridLayout), SQLITE_OK);
+		sqlite3_stmt* psEdgeQueueIsInit;
+		CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, EDGE_QUEUE_IS_INIT_SQL, -1, &psEdgeQueueIsInit, nullptr), SQLITE_OK);
+		int edgeQueueReturnCode = sqlite3_step(psEdgeQueueIsInit);
+		if (edgeQueueReturnCode != SQLITE_ROW) CHECK_RETURN_CODE(edgeQueueReturnCode, SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_finalize(psEdgeQueueIsInit), SQLITE_OK);
+		if (edgeQueueReturnCode == SQLITE_ROW) gridLayoutVersion = 1;
+		CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, GRID_LAYOUT_INIT_SQL, -1, &psGridLayout, nullptr), SQLITE_OK);
+		CHECK_RETURN_CODE(sqlite3_bind_int(psGridLayout, 1, int(gridLayoutVersion)), SQLITE_OK);
+		CHECK_RETURN_CODE(sqlite3_step(psGridLayout), SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_finalize(psGridLayout), SQLITE_OK);
+	}
+	if (gridLayoutVersion != 1 && gridLayoutVersion != GRID_LAYOUT_VERSION) {
+		sqlite3_close(m_db);
+		throw std::runtime_error("tablebase was written with grid layout version " + std::to_string(gridLayoutVersion));
+	}
+	m_legacyLayout = LEGACY_LAYOUT_DIFFERS && gridLayoutVersion == 1;
 
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, BEGIN_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psBegin, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, COMMIT_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psCommit, nullptr), SQLITE_OK);
 
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, INSERT_NODE_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psInsertNode, nullptr), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, bulkInsertSql(BULK_INSERT_NODE_SQL, "(?, ?, ?)").c_str(), -1, SQLITE_PREPARE_PERSISTENT, &m_psBulkInsertNode, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, UPDATE_NODE_INTER_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psUpdateNodeInter, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, UPDATE_NODE_NONINTER_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psUpdateNodeNoninter, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, QUERY_NODE_SCORES_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psQueryNodeScores, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, QUERY_NODE_EXISTS_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psQueryNodeExists, nullptr), SQLITE_OK);
 
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, INSERT_EDGE_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psInsertEdge, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, QUERY_EDGE_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psQueryEdge, nullptr), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, bulkInsertSql(BULK_INSERT_EDGE_SQL, "(?, ?, ?)").c_str(), -1, SQLITE_PREPARE_PERSISTENT, &m_psBulkInsertEdge, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, QUERY_EDGES_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psQueryEdges, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, QUERY_REVERSE_EDGES_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psQueryReverseEdges, nullptr), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, QUERY_CHILD_EDGES_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psQueryChildEdges, nullptr), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, QUERY_PARENT_EDGES_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psQueryParentEdges, nullptr), SQLITE_OK);
 
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, EDGE_QUEUE_GET_FRONT_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psEdgeQueueGetFront, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, EDGE_QUEUE_POP_FRONT_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psEdgeQueuePopFront, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, EDGE_QUEUE_PUSH_BACK_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psEdgeQueuePushBack, nullptr), SQLITE_OK);
-
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, SCORE_QUEUE_GET_FRONT_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psScoreQueueGetFront, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, SCORE_QUEUE_POP_FRONT_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psScoreQueuePopFront, nullptr), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, SCORE_QUEUE_PUSH_BACK_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psScoreQueuePushBack, nullptr), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_prepare_v3(m_db, COPY_NODES_TO_SCORE_QUEUE_SQL, -1, SQLITE_PREPARE_PERSISTENT, &m_psCopyNodesToScoreQueue, nullptr), SQLITE_OK);
 
 	// Set the values of m_edgeQueueInitialize and m_scoreQueueInitialized from the config table;
 	sqlite3_stmt* psQueueIsInit;
 	CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, EDGE_QUEUE_IS_INIT_SQL, -1, &psQueueIsInit, nullptr), SQLITE_OK);
-	int returnCode = sqlite3_step(psQueueIsInit);
+	returnCode = sqlite3_step(psQueueIsInit);
 	if (returnCode == SQLITE_ROW) {
-		ITablebase<N>::m_edgeQueueInitialized = true;
+		this->m_edgeQueueInitialized = true;
 	}
 	else {
 		CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
-		ITablebase<N>::m_edgeQueueInitialized = false;
+		this->m_edgeQueueInitialized = false;
 	}
 	CHECK_RETURN_CODE(sqlite3_reset(psQueueIsInit), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_finalize(psQueueIsInit), SQLITE_OK);
@@ -636,14 +2770,28 @@ SqliteTablebase<N>::SqliteTablebase(float fourChance, const std::string& dbName,
 	CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, SCORE_QUEUE_IS_INIT_SQL, -1, &psQueueIsInit, nullptr), SQLITE_OK);
 	returnCode = sqlite3_step(psQueueIsInit);
 	if (returnCode == SQLITE_ROW) {
-		ITablebase<N>::m_scoreQueueInitialized = true;
+		this->m_scoreQueueInitialized = true;
 	}
 	else {
 		CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
-		ITablebase<N>::m_scoreQueueInitialized = false;
+		this->m_scoreQueueInitialized = false;
 	}
 	CHECK_RETURN_CODE(sqlite3_reset(psQueueIsInit), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_finalize(psQueueIsInit), SQLITE_OK);
+
+	loadQueue(m_edgeQueue, EDGE_QUEUE_CURSOR);
+	loadQueue(m_scoreQueue, SCORE_QUEUE_CURSOR);
+	migrateQueueTable(LEGACY_EDGE_QUEUE_SQL, DROP_LEGACY_EDGE_QUEUE_SQL, m_edgeQueue, EDGE_QUEUE_CURSOR, [this](sqlite3_stmt* statement) {
+		QueuedState queued;
+		readGrid(statement, 0, queued.node);
+		queued.depth = sqlite3_column_int(statement, 1);
+		return queued;
+	});
+	migrateQueueTable(LEGACY_SCORE_QUEUE_SQL, DROP_LEGACY_SCORE_QUEUE_SQL, m_scoreQueue, SCORE_QUEUE_CURSOR, [this](sqlite3_stmt* statement) {
+		GridState<N> node;
+		readGrid(statement, 0, node);
+		return node;
+	});
 }
 
 template<uint N>
@@ -652,38 +2800,171 @@ SqliteTablebase<N>::~SqliteTablebase() {
 	sqlite3_finalize(m_psCommit);
 
 	sqlite3_finalize(m_psInsertNode);
+	sqlite3_finalize(m_psBulkInsertNode);
 	sqlite3_finalize(m_psUpdateNodeInter);
 	sqlite3_finalize(m_psUpdateNodeNoninter);
 	sqlite3_finalize(m_psQueryNodeScores);
 	sqlite3_finalize(m_psQueryNodeExists);
 
 	sqlite3_finalize(m_psInsertEdge);
-	sqlite3_finalize(m_psQueryEdge);
+	sqlite3_finalize(m_psBulkInsertEdge);
 	sqlite3_finalize(m_psQueryEdges);
-	sqlite3_finalize(m_psQueryReverseEdges);
-
-	sqlite3_finalize(m_psEdgeQueueGetFront);
-	sqlite3_finalize(m_psEdgeQueuePopFront);
-	sqlite3_finalize(m_psEdgeQueuePushBack);
+	sqlite3_finalize(m_psQueryChildEdges);
+	sqlite3_finalize(m_psQueryParentEdges);
 
-	sqlite3_finalize(m_psScoreQueueGetFront);
-	sqlite3_finalize(m_psScoreQueuePopFront);
-	sqlite3_finalize(m_psScoreQueuePushBack);
 	sqlite3_finalize(m_psCopyNodesToScoreQueue);
 
 	sqlite3_close(m_db);
 }
 
+template<uint N>
+std::string SqliteTablebase<N>::databasePath(float fourChance, const std::string& dbName) {
+	if (!dbName.empty()) return dbName;
+	std::ostringstream dbNameStr;
+	dbNameStr << "2048_tb_" << N << '-' << fourChance << ".sqlite";
+	return dbNameStr.str();
+}
+
+template<uint N>
+template<class T>
+void SqliteTablebase<N>::saveQueue(SpillQueue<T>& queue, const char* name) {
+	auto cursor = queue.checkpoint();
+	std::string value = std::to_string(cursor.head) + ' ' + std::to_string(cursor.tail) + ' ' + std::to_string(cursor.fileBase);
+	sqlite3_stmt* psSave;
+	CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, QUEUE_CURSOR_SAVE_SQL, -1, &psSave, nullptr), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_bind_text(psSave, 1, name, -1, SQLITE_STATIC), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_bind_text(psSave, 2, value.c_str(), -1, SQLITE_STATIC), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_step(psSave), SQLITE_DONE);
+	CHECK_RETURN_CODE(sqlite3_finalize(psSave), SQLITE_OK);
+}
+
+template<uint N>
+template<class T>
+void SqliteTablebase<N>::loadQueue(SpillQueue<T>& queue, const char* name) {
+	sqlite3_stmt* psQuery;
+	CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, QUEUE_CURSOR_QUERY_SQL, -1, &psQuery, nullptr), SQLITE_OK);
+	CHECK_RETURN_CODE(sqlite3_bind_text(psQuery, 1, name, -1, SQLITE_STATIC), SQLITE_OK);
+	int returnCode = sqlite3_step(psQuery);
+	if (returnCode == SQLITE_ROW) {
+		typename SpillQueue<T>::Cursor cursor;
+		std::istringstream value(reinterpret_cast<const char*>(sqlite3_column_text(psQuery, 0)));
+		value >> cursor.head >> cursor.tail >> cursor.fileBase;
+		if (!value) {
+			sqlite3_finalize(psQuery);
+			throw std::runtime_error(std::string("invalid ") + name + " in config table");
+		}
+		queue.restore(cursor);
+	}
+	else {
+		CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
+	}
+	CHECK_RETURN_CODE(sqlite3_finalize(psQuery), SQLITE_OK);
+}
+
+// Only databases from before the queue files have queue tables, so for any other the select fails to prepare
+template<uint N>
+template<class T, class F>
+void SqliteTablebase<N>::migrateQueueTable(const char* selectSql, const char* dropSql, SpillQueue<T>& queue, const char* name, F&& readRow) {
+	sqlite3_stmt* psSelect;
+	if (sqlite3_prepare_v2(m_db, selectSql, -1, &psSelect, nullptr) != SQLITE_OK) return;
+	int returnCode;
+	while ((returnCode = sqlite3_step(psSelect)) == SQLITE_ROW) queue.push(readRow(psSelect));
+	CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
+	CHECK_RETURN_CODE(sqlite3_finalize(psSelect), SQLITE_OK);
+	beginTransaction();
+	CHECK_RETURN_CODE(sqlite3_exec(m_db, dropSql, nullptr, nullptr, nullptr), SQLITE_OK);
+	saveQueue(queue, name);
+	commitTransaction();
+}
+
 template<uint N>
 void SqliteTablebase<N>::initializeEdgeQueue() {
-	ITablebase<N>::initializeEdgeQueue();
+	Core::initializeEdgeQueue();
+	beginTransaction();
+	saveQueue(m_edgeQueue, EDGE_QUEUE_CURSOR);
 	CHECK_RETURN_CODE(sqlite3_exec(m_db, EDGE_QUEUE_INIT_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
+	commitTransaction();
+}
+
+// Staged rows never outlive the transaction, so the database is as complete after every call as without staging
+template<uint N>
+void SqliteTablebase<N>::generateEdges(uint64 maxActions, int maxDepth) {
+	beginTransaction();
+	m_staging = m_bulkWrites;
+	Core::generateEdges(maxActions, maxDepth);
+	flushStaged();
+	m_staging = false;
+	saveQueue(m_edgeQueue, EDGE_QUEUE_CURSOR);
+	commitTransaction();
+}
+
+template<uint N>
+void SqliteTablebase<N>::calculateScores(uint64 maxActions) {
+	beginTransaction();
+	Core::calculateScores(maxActions);
+	saveQueue(m_scoreQueue, SCORE_QUEUE_CURSOR);
+	commitTransaction();
+}
+
+template<uint N>
+void SqliteTablebase<N>::flushStaged() {
+	uint64 rows = m_stagedNodes.size() + m_stagedEdges.size();
+	if (rows == 0) return;
+	auto start = std::chrono::steady_clock::now();
+
+	const auto& nodes = m_stagedNodes.values();
+	insertRows(m_psBulkInsertNode, m_psInsertNode, 3, nodes.size(), [this, &nodes](sqlite3_stmt* statement, int param, uint64 i) {
+		const auto& [node, scores] = nodes[i];
+		bindGrid(statement, param, node);
+		CHECK_RETURN_CODE(sqlite3_bind_double(statement, param + 1, scores.second), SQLITE_OK);
+		CHECK_RETURN_CODE(sqlite3_bind_double(statement, param + 2, scores.first), SQLITE_OK);
+	});
+	insertRows(m_psBulkInsertEdge, m_psInsertEdge, 3, m_stagedEdges.size(), [this](sqlite3_stmt* statement, int param, uint64 i) {
+		const auto& [parent, child, weight] = m_stagedEdges[i];
+		bindGrid(statement, param, parent);
+		bindGrid(statement, param + 1, child);
+		CHECK_RETURN_CODE(sqlite3_bind_double(statement, param + 2, weight), SQLITE_OK);
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	++m_flushStats.flushes;
+	m_flushStats.rows += rows;
+	m_flushStats.seconds += seconds;
+	DEBUG_LOG("flushed " << m_stagedNodes.size() << " nodes and " << m_stagedEdges.size() << " edges in " << seconds << " s (" << rows / std::max(seconds, 1e-9) << " rows/s)" << std::endl);
+	m_stagedNodes.clear();
+	m_stagedEdges.clear();
+}
+
+template<uint N>
+template<class F>
+void SqliteTablebase<N>::insertRows(sqlite3_stmt* bulkStatement, sqlite3_stmt* rowStatement, uint columns, uint64 count, F&& bindRow) {
+	uint64 row = 0;
+	for (; row + BULK_INSERT_ROWS <= count; row += BULK_INSERT_ROWS) {
+		for (uint i = 0; i < BULK_INSERT_ROWS; ++i) bindRow(bulkStatement, int(i * columns + 1), row + i);
+		CHECK_RETURN_CODE(sqlite3_step(bulkStatement), SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_reset(bulkStatement), SQLITE_OK);
+	}
+	for (; row < count; ++row) {
+		bindRow(rowStatement, 1, row);
+		CHECK_RETURN_CODE(sqlite3_step(rowStatement), SQLITE_DONE);
+		CHECK_RETURN_CODE(sqlite3_reset(rowStatement), SQLITE_OK);
+	}
+}
+
+template<uint N>
+std::string SqliteTablebase<N>::bulkInsertSql(const char* insert, const char* values) {
+	std::string sql = insert;
+	for (uint i = 0; i < BULK_INSERT_ROWS; ++i) {
+		if (i > 0) sql += ", ";
+		sql += values;
+	}
+	return sql + ";";
 }
 
 template<uint N>
 float SqliteTablebase<N>::query(const GridState<N>& state) const {
-	if (hasNode(state)) {
-		return getNodeScores(state).first;
+	GridState<N> node = this->toKey(state);
+	if (hasNode(node)) {
+		return getNodeScores(node).first;
 	}
 	else {
 		return -1;
@@ -692,12 +2973,24 @@ float SqliteTablebase<N>::query(const GridState<N>& state) const {
 
 template<uint N>
 void SqliteTablebase<N>::setNode(const GridState<N>& node, float noninterScore, float interScore) {
+	if (m_staging) {
+		auto staged = m_stagedNodes.find(node);
+		if (staged != m_stagedNodes.end()) {
+			staged->second = std::make_pair(noninterScore, interScore);
+			return;
+		}
+		if (!hasNode(node)) {
+			m_stagedNodes.emplace(node, std::make_pair(noninterScore, interScore));
+			flushIfFull();
+			return;
+		}
+	}
 	if (hasNode(node)) {
 		addInterScore(node, interScore);
 		addNonInterScore(node, noninterScore);
 	}
 	else {
-		CHECK_RETURN_CODE(sqlite3_bind_blob(m_psInsertNode, 1, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
+		bindGrid(m_psInsertNode, 1, node);
 		CHECK_RETURN_CODE(sqlite3_bind_double(m_psInsertNode, 2, interScore), SQLITE_OK);
 		CHECK_RETURN_CODE(sqlite3_bind_double(m_psInsertNode, 3, noninterScore), SQLITE_OK);
 		CHECK_RETURN_CODE(sqlite3_step(m_psInsertNode), SQLITE_DONE);
@@ -707,7 +3000,8 @@ void SqliteTablebase<N>::setNode(const GridState<N>& node, float noninterScore,
 
 template<uint N>
 bool SqliteTablebase<N>::hasNode(const GridState<N>& node) const {
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psQueryNodeExists, 1, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
+	if (m_staging && m_stagedNodes.contains(node)) return true;
+	bindGrid(m_psQueryNodeExists, 1, node);
 	CHECK_RETURN_CODE(sqlite3_step(m_psQueryNodeExists), SQLITE_ROW);
 	bool foundNode = (sqlite3_column_int(m_psQueryNodeExists, 0) == 1);
 	CHECK_RETURN_CODE(sqlite3_step(m_psQueryNodeExists), SQLITE_DONE);
@@ -718,7 +3012,7 @@ bool SqliteTablebase<N>::hasNode(const GridState<N>& node) const {
 template<uint N>
 std::pair<float, float> SqliteTablebase<N>::getNodeScores(const GridState<N>& node) const {
 	QUERY_NODE_SCORES_SQL;
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psQueryNodeScores, 1, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
+	bindGrid(m_psQueryNodeScores, 1, node);
 	CHECK_RETURN_CODE(sqlite3_step(m_psQueryNodeScores), SQLITE_ROW);
 	double interScore = sqlite3_column_double(m_psQueryNodeScores, 0);
 	double noninterScore = sqlite3_column_double(m_psQueryNodeScores, 1);
@@ -727,49 +3021,46 @@ std::pair<float, float> SqliteTablebase<N>::getNodeScores(const GridState<N>& no
 	return std::make_pair(float(noninterScore), float(interScore));
 }
 
+template<uint N>
+template<class F>
+void SqliteTablebase<N>::forEachNode(F&& f) const {
+	sqlite3_stmt* psQueryAllNodes;
+	CHECK_RETURN_CODE(sqlite3_prepare_v2(m_db, QUERY_ALL_NODES_SQL, -1, &psQueryAllNodes, nullptr), SQLITE_OK);
+	int returnCode;
+	while ((returnCode = sqlite3_step(psQueryAllNodes)) == SQLITE_ROW) {
+		GridState<N> node;
+		readGrid(psQueryAllNodes, 0, node);
+		f(node, float(sqlite3_column_double(psQueryAllNodes, 1)), float(sqlite3_column_double(psQueryAllNodes, 2)));
+	}
+	CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
+	CHECK_RETURN_CODE(sqlite3_finalize(psQueryAllNodes), SQLITE_OK);
+}
+
 template<uint N>
 void SqliteTablebase<N>::pushToEdgeQueue(const GridState<N>& node, int depth) {
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psEdgeQueuePushBack, 1, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_bind_int(m_psEdgeQueuePushBack, 2, depth), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_step(m_psEdgeQueuePushBack), SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psEdgeQueuePushBack), SQLITE_OK);
+	m_edgeQueue.push(QueuedState{ node, depth });
 }
 
 template<uint N>
 std::pair<GridState<N>, int> SqliteTablebase<N>::popFromEdgeQueue() {
-	CHECK_RETURN_CODE(sqlite3_step(m_psEdgeQueueGetFront), SQLITE_ROW);
-	GridState<N> node;
-	const void* nodeGrid = sqlite3_column_blob(m_psEdgeQueueGetFront, 0);
-	std::memcpy(node.gridData(), nodeGrid, sizeof(node.getGrid()));
-	int nodeDepth = sqlite3_column_int(m_psEdgeQueueGetFront, 1);
-	CHECK_RETURN_CODE(sqlite3_step(m_psEdgeQueueGetFront), SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psEdgeQueueGetFront), SQLITE_OK);
-
-	CHECK_RETURN_CODE(sqlite3_step(m_psEdgeQueuePopFront), SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psEdgeQueuePopFront), SQLITE_OK);
-
-	return std::make_pair(node, nodeDepth);
+	QueuedState queued = m_edgeQueue.pop();
+	return std::make_pair(queued.node, queued.depth);
 }
 
 template<uint N>
 bool SqliteTablebase<N>::edgeQueueEmpty() {
-	int returnCode = sqlite3_step(m_psEdgeQueueGetFront);
-	bool isEmpty;
-	if (returnCode == SQLITE_ROW) {
-		isEmpty = false;
-	}
-	else {
-		CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
-		isEmpty = true;
-	}
-	CHECK_RETURN_CODE(sqlite3_reset(m_psEdgeQueueGetFront), SQLITE_OK);
-	return isEmpty;
+	return m_edgeQueue.empty();
 }
 
 template<uint N>
 void SqliteTablebase<N>::addEdge(const GridState<N>& parent, const GridState<N>& child, float weight) {
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psInsertEdge, 1, parent.gridData(), sizeof(parent.getGrid()), SQLITE_STATIC), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psInsertEdge, 2, child.gridData(), sizeof(child.getGrid()), SQLITE_STATIC), SQLITE_OK);
+	if (m_staging) {
+		m_stagedEdges.emplace_back(parent, child, weight);
+		flushIfFull();
+		return;
+	}
+	bindGrid(m_psInsertEdge, 1, parent);
+	bindGrid(m_psInsertEdge, 2, child);
 	CHECK_RETURN_CODE(sqlite3_bind_double(m_psInsertEdge, 3, weight), SQLITE_OK);
 	CHECK_RETURN_CODE(sqlite3_step(m_psInsertEdge), SQLITE_DONE);
 	CHECK_RETURN_CODE(sqlite3_reset(m_psInsertEdge), SQLITE_OK);
@@ -777,7 +3068,7 @@ void SqliteTablebase<N>::addEdge(const GridState<N>& parent, const GridState<N>&
 
 template<uint N>
 bool SqliteTablebase<N>::hasEdge(const GridState<N>& node) const {
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psQueryEdges, 1, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
+	bindGrid(m_psQueryEdges, 1, node);
 	int returnCode = sqlite3_step(m_psQueryEdges);
 	bool foundEdge;
 	if (returnCode == SQLITE_ROW) {
@@ -792,95 +3083,112 @@ bool SqliteTablebase<N>::hasEdge(const GridState<N>& node) const {
 }
 
 template<uint N>
-std::vector<GridState<N>> SqliteTablebase<N>::getEdges(const GridState<N>& node) const {
-	std::vector<GridState<N>> edges;
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psQueryEdges, 1, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
-	int returnCode;
-	while ((returnCode = sqlite3_step(m_psQueryEdges)) == SQLITE_ROW) {
-		edges.emplace_back();
-		const void* childGrid = sqlite3_column_blob(m_psQueryEdges, 0);
-		std::memcpy(edges.back().gridData(), childGrid, sizeof(node.getGrid()));
+void SqliteTablebase<N>::getChildEdges(const GridState<N>& node, std::vector<typename Core::Edge>& edges) const {
+	readEdges(m_psQueryChildEdges, node, edges);
+}
+
+template<uint N>
+void SqliteTablebase<N>::getParentEdges(const GridState<N>& child, std::vector<typename Core::Edge>& edges) const {
+	readEdges(m_psQueryParentEdges, child, edges);
+}
+
+template<uint N>
+template<class TO, class FROM>
+TO SqliteTablebase<N>::convertGrid(const FROM& grid) {
+	TO converted;
+	for (uint r = 0; r < N; ++r) {
+		for (uint c = 0; c < N; ++c) converted.writeTile(r, c, grid.readTile(r, c));
+	}
+	return converted;
+}
+
+// A legacy canonical key is the smallest symmetry in the legacy layout, so it is canonicalized again after
+// converting, in either direction
+template<uint N>
+void SqliteTablebase<N>::readGrid(sqlite3_stmt* statement, int column, GridState<N>& grid) const {
+	const void* blob = sqlite3_column_blob(statement, column);
+	size_t gridBytes = m_legacyLayout ? LegacyGrid::GRID_DATA_BYTES : GridState<N>::GRID_DATA_BYTES;
+	if (sqlite3_column_bytes(statement, column) != int(gridBytes)) {
+		throw std::runtime_error("database grid of " + std::to_string(sqlite3_column_bytes(statement, column)) + " bytes was written with a different grid layout");
+	}
+	if (m_legacyLayout) {
+		LegacyGrid legacy;
+		std::memcpy(legacy.gridData(), blob, gridBytes);
+		grid = this->toKey(convertGrid<GridState<N>>(legacy));
+	}
+	else {
+		std::memcpy(grid.gridData(), blob, gridBytes);
 	}
-	CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psQueryEdges), SQLITE_OK);
-	return edges;
 }
 
 template<uint N>
-float SqliteTablebase<N>::getEdgeWeight(const GridState<N>& parent, const GridState<N>& child) const {
-	QUERY_EDGE_SQL;
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psQueryEdge, 1, parent.gridData(), sizeof(parent.getGrid()), SQLITE_STATIC), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psQueryEdge, 2, child.gridData(), sizeof(child.getGrid()), SQLITE_STATIC), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_step(m_psQueryEdge), SQLITE_ROW);
-	double weight = sqlite3_column_double(m_psQueryEdge, 0);
-	CHECK_RETURN_CODE(sqlite3_step(m_psQueryEdge), SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psQueryEdge), SQLITE_OK);
-	return weight;
+void SqliteTablebase<N>::bindGrid(sqlite3_stmt* statement, int param, const GridState<N>& grid) const {
+	if (m_legacyLayout) {
+		LegacyGrid legacy = convertGrid<LegacyGrid>(grid);
+		if (this->m_canonicalKeys) legacy = legacy.canonical().first;
+		CHECK_RETURN_CODE(sqlite3_bind_blob(statement, param, legacy.gridData(), LegacyGrid::GRID_DATA_BYTES, SQLITE_TRANSIENT), SQLITE_OK);
+	}
+	else {
+		CHECK_RETURN_CODE(sqlite3_bind_blob(statement, param, grid.gridData(), GridState<N>::GRID_DATA_BYTES, SQLITE_STATIC), SQLITE_OK);
+	}
 }
 
+// The scores of the other end are joined in, so each edge costs one row instead of a query for its weight and
+// another for its scores
 template<uint N>
-std::vector<GridState<N>> SqliteTablebase<N>::getParents(const GridState<N>& child) const { 
-	auto parents = std::vector<GridState<N>>();
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psQueryReverseEdges, 1, child.gridData(), sizeof(child.getGrid()), SQLITE_STATIC), SQLITE_OK);
+void SqliteTablebase<N>::readEdges(sqlite3_stmt* statement, const GridState<N>& state, std::vector<typename Core::Edge>& edges) const {
+	edges.clear();
+	bindGrid(statement, 1, state);
 	int returnCode;
-	while ((returnCode = sqlite3_step(m_psQueryReverseEdges)) == SQLITE_ROW) {
-		parents.emplace_back();
-		const void* parentGrid = sqlite3_column_blob(m_psQueryReverseEdges, 0);
-		std::memcpy(parents.back().gridData(), parentGrid, sizeof(child.getGrid()));
+	while ((returnCode = sqlite3_step(statement)) == SQLITE_ROW) {
+		auto& edge = edges.emplace_back();
+		readGrid(statement, 0, edge.other);
+		edge.weight = float(sqlite3_column_double(statement, 1));
+		edge.scores.first = sqlite3_column_type(statement, 2) == SQLITE_NULL ? -1.0f : float(sqlite3_column_double(statement, 2));
+		edge.scores.second = sqlite3_column_type(statement, 3) == SQLITE_NULL ? -1.0f : float(sqlite3_column_double(statement, 3));
 	}
 	CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psQueryReverseEdges), SQLITE_OK);
-	return parents;
+	CHECK_RETURN_CODE(sqlite3_reset(statement), SQLITE_OK);
 }
 
+// Generation never looks edges up by child, so the index for that is only built once every edge is in the table.
+// Nodes are queued newest first, so that children tend to be scored before their parents.
 template<uint N>
 void SqliteTablebase<N>::copyNodesToScoreQueue() {
-	CHECK_RETURN_CODE(sqlite3_step(m_psCopyNodesToScoreQueue), SQLITE_DONE);
+	CHECK_RETURN_CODE(sqlite3_exec(m_db, CREATE_INDEX_REVERSE_EDGE_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
+	int returnCode;
+	while ((returnCode = sqlite3_step(m_psCopyNodesToScoreQueue)) == SQLITE_ROW) {
+		GridState<N> node;
+		readGrid(m_psCopyNodesToScoreQueue, 0, node);
+		m_scoreQueue.push(node);
+	}
+	CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
 	CHECK_RETURN_CODE(sqlite3_reset(m_psCopyNodesToScoreQueue), SQLITE_OK);
+	beginTransaction();
+	saveQueue(m_scoreQueue, SCORE_QUEUE_CURSOR);
 	CHECK_RETURN_CODE(sqlite3_exec(m_db, SCORE_QUEUE_INIT_SQL, nullptr, nullptr, nullptr), SQLITE_OK);
+	commitTransaction();
 }
 
 template<uint N>
 void SqliteTablebase<N>::pushToScoreQueue(const GridState<N>& node) {
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psScoreQueuePushBack, 1, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_step(m_psScoreQueuePushBack), SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psScoreQueuePushBack), SQLITE_OK);
+	m_scoreQueue.push(node);
 }
 
 template<uint N>
 GridState<N> SqliteTablebase<N>::popFromScoreQueue() {
-	CHECK_RETURN_CODE(sqlite3_step(m_psScoreQueueGetFront), SQLITE_ROW);
-	GridState<N> node;
-	const void* nodeGrid = sqlite3_column_blob(m_psScoreQueueGetFront, 0);
-	std::memcpy(node.gridData(), nodeGrid, sizeof(node.getGrid()));
-	CHECK_RETURN_CODE(sqlite3_step(m_psScoreQueueGetFront), SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psScoreQueueGetFront), SQLITE_OK);
-
-	CHECK_RETURN_CODE(sqlite3_step(m_psScoreQueuePopFront), SQLITE_DONE);
-	CHECK_RETURN_CODE(sqlite3_reset(m_psScoreQueuePopFront), SQLITE_OK);
-
-	return node;
+	return m_scoreQueue.pop();
 }
 
 template<uint N>
 bool SqliteTablebase<N>::scoreQueueEmpty() const {
-	int returnCode = sqlite3_step(m_psScoreQueueGetFront);
-	bool isEmpty;
-	if (returnCode == SQLITE_ROW) {
-		isEmpty = false;
-	}
-	else {
-		CHECK_RETURN_CODE(returnCode, SQLITE_DONE);
-		isEmpty = true;
-	}
-	CHECK_RETURN_CODE(sqlite3_reset(m_psScoreQueueGetFront), SQLITE_OK);
-	return isEmpty;
+	return m_scoreQueue.empty();
 }
 
 template<uint N>
 void SqliteTablebase<N>::addInterScore(const GridState<N>& node, float score) {
 	CHECK_RETURN_CODE(sqlite3_bind_double(m_psUpdateNodeInter, 1, double(score)), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psUpdateNodeInter, 2, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
+	bindGrid(m_psUpdateNodeInter, 2, node);
 	CHECK_RETURN_CODE(sqlite3_step(m_psUpdateNodeInter), SQLITE_DONE);
 	CHECK_RETURN_CODE(sqlite3_reset(m_psUpdateNodeInter), SQLITE_OK);
 }
@@ -890,7 +3198,7 @@ void SqliteTablebase<N>::addNonInterScore(const GridState<N>& node, float score)
 	UPDATE_NODE_NONINTER_SQL;
 	UPDATE_NODE_INTER_SQL;
 	CHECK_RETURN_CODE(sqlite3_bind_double(m_psUpdateNodeNoninter, 1, double(score)), SQLITE_OK);
-	CHECK_RETURN_CODE(sqlite3_bind_blob(m_psUpdateNodeNoninter, 2, node.gridData(), sizeof(node.getGrid()), SQLITE_STATIC), SQLITE_OK);
+	bindGrid(m_psUpdateNodeNoninter, 2, node);
 	CHECK_RETURN_CODE(sqlite3_step(m_psUpdateNodeNoninter), SQLITE_DONE);
 	CHECK_RETURN_CODE(sqlite3_reset(m_psUpdateNodeNoninter), SQLITE_OK);
 }
@@ -4,6 +4,85 @@ compiled_sizes = {2, 3, 4, 5, 6, 7, 8}
 compiled_sizes_str_list = list(compiled_sizes)
 compiled_sizes_str_list = [str(s) for s in compiled_sizes_str_list]
 
+def tile_log2(x):
+	return x.bit_length()
+
+# Port of GridState::slideRow, including its handling of lastSlideFused and of tiles at max_tile not merging, so
+# the tables reproduce swipe() exactly
+def slide_line(tiles, toward_end, max_tile):
+	n = len(tiles)
+	tiles = list(tiles)
+	sum_of_new_tiles = 0
+	last_slide_fused = False
+	if toward_end:
+		for ci in range(n - 1, -1, -1):
+			for cf in range(ci + 1, n):
+				if tiles[cf] == 0:
+					tiles[cf], tiles[cf - 1] = tiles[cf - 1], tiles[cf]
+					if cf == 0:
+						last_slide_fused = False
+				elif tiles[cf] == tiles[cf - 1] and tiles[cf] != max_tile and not last_slide_fused:
+					last_slide_fused = True
+					tiles[cf] += 1
+					sum_of_new_tiles += 1 << tiles[cf]
+					tiles[cf - 1] = 0
+					break
+				else:
+					last_slide_fused = False
+					break
+	else:
+		for ci in range(1, n):
+			for cf in range(ci - 1, -1, -1):
+				if tiles[cf] == 0:
+					tiles[cf], tiles[cf + 1] = tiles[cf + 1], tiles[cf]
+					if cf == 0:
+						last_slide_fused = False
+				elif tiles[cf] == tiles[cf + 1] and tiles[cf] != max_tile and not last_slide_fused:
+					last_slide_fused = True
+					tiles[cf] += 1
+					sum_of_new_tiles += 1 << tiles[cf]
+					tiles[cf + 1] = 0
+					break
+				else:
+					last_slide_fused = False
+					break
+	return tiles, sum_of_new_tiles
+
+def write_slide_table(f, n, bits):
+	tile_mask = (1 << bits) - 1
+	lines = {True: [], False: []}
+	scores = {True: [], False: []}
+	for line in range(1 << (n * bits)):
+		tiles = [(line >> (i * bits)) & tile_mask for i in range(n)]
+		for toward_end in (True, False):
+			slid, score = slide_line(tiles, toward_end, tile_mask)
+			lines[toward_end].append(sum(t << (i * bits) for i, t in enumerate(slid)))
+			scores[toward_end].append(score)
+	f.write("template<>\n")
+	f.write(f"struct SlideTable<{n}, {bits}> {{\n")
+	f.write("\tstatic constexpr bool AVAILABLE = true;\n")
+	for name, toward_end in (("TOWARD_START", False), ("TOWARD_END", True)):
+		f.write(f"\tstatic constexpr uint16_t {name}[{1 << (n * bits)}] = {{ {','.join(str(x) for x in lines[toward_end])} }};\n")
+		f.write(f"\tstatic constexpr uint32_t {name}_SCORE[{1 << (n * bits)}] = {{ {','.join(str(x) for x in scores[toward_end])} }};\n")
+	f.write("};\n\n")
+
+# (size, bits per tile) of every compiled board that fits in one 64 bit word with lines of at most 16 bits,
+# plus the capped 4x4 board (CappedGridState<4, 15>)
+slide_table_configs = sorted({(n, tile_log2(n * n + 1)) for n in compiled_sizes if n * n * tile_log2(n * n + 1) <= 64 and n * tile_log2(n * n + 1) <= 16} | {(4, 4)})
+
+with open("SlideTables.h", "w") as f:
+	f.write("// Generated by TemplateAdaptorGenerator.py\n")
+	f.write("#pragma once\n\n")
+	f.write("#include <cstdint>\n\n")
+	f.write("// Maps a line of N tiles, tile i packed at bit i * TILE_BITS, to the line after sliding it towards\n")
+	f.write("// index 0 (TOWARD_START) or index N - 1 (TOWARD_END), and to the sum of the tiles created by merges.\n")
+	f.write("template<unsigned N, unsigned TILE_BITS>\n")
+	f.write("struct SlideTable {\n")
+	f.write("\tstatic constexpr bool AVAILABLE = false;\n")
+	f.write("};\n\n")
+	for n, bits in slide_table_configs:
+		write_slide_table(f, n, bits)
+
 with open("TemplateAdaptor.cc", "w") as f:
 	f.write("#include <stdexcept>\n\n")
 	f.write("#include \"TemplateAdaptor.h\"\n\n")
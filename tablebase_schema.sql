@@ -10,20 +10,14 @@ CREATE TABLE edge (
     PRIMARY KEY (start_state, end_state)
 ) STRICT;
 
-CREATE TABLE edge_queue (
-    id INTEGER PRIMARY KEY AUTOINCREMENT,
-    node BLOB NOT NULL,
-    node_depth INTEGER NOT NULL
-) STRICT;
-
-CREATE TABLE score_queue (
-    id INTEGER PRIMARY KEY AUTOINCREMENT,
-    node BLOB NOT NULL
-) STRICT;
-
+-- The edge and score queues are kept in the files <database>.edge_queue and <database>.score_queue. Their cursors are
+-- the edge_queue_cursor and score_queue_cursor rows of config.
+-- The grid_layout_version row is 2 when grids are stored as GridState's word packed tiles. Databases without it, or
+-- with 1, store every grid as packed_bitset, which only differs for boards larger than 3x3.
 CREATE TABLE config (
     prop_name TEXT PRIMARY KEY,
     prop_value TEXT
 ) STRICT;
 
+-- Built once every edge is in the table, before scores are calculated
 CREATE INDEX reverse_edge ON edge(end_state);
\ No newline at end of file